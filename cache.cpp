@@ -0,0 +1,124 @@
+/*
+Fitness cache: remembers the score of every setup simulated with Box2D, keyed by a hash of everything
+in the setup that the simulation looks at. A lot of children are exact copies of their parent
+(at a 5% mutation rate, usually none of the platforms are mutated), so this saves simulating them again.
+Platforms are hashed in order, because the order they're created in can change Box2D's results.
+*/
+
+static u64 fitness_hash_float(u64 h, float x) {
+	x += 0.0f; // -0 => +0
+	u32 bits;
+	memcpy(&bits, &x, sizeof bits);
+	return hash_u64(h ^ bits);
+}
+
+// hash of a setup, for the fitness cache. never returns 0 (that marks an empty entry).
+static u64 fitness_hash(State const *state, Setup const *setup) {
+	u64 h = hash_u64(setup->nplatforms | (u64)state->ballistic_exit << 32);
+	for (u32 i = 0; i < setup->nplatforms; ++i) {
+		Platform const *p = &setup->platforms[i];
+		// (not body or color, which don't affect the score)
+		h = hash_u64(h ^ ((u64)p->moves | (u64)p->rotates << 1));
+		h = fitness_hash_float(h, p->radius);
+		h = fitness_hash_float(h, p->start_angle);
+		h = fitness_hash_float(h, p->angle); // the body is created at this angle before it's reset to start_angle
+		h = fitness_hash_float(h, p->rotate_speed);
+		if (p->moves) {
+			// moving platforms start at move_p1, whatever center is
+			h = fitness_hash_float(h, p->move_speed);
+			h = fitness_hash_float(h, p->move_p1.x);
+			h = fitness_hash_float(h, p->move_p1.y);
+			h = fitness_hash_float(h, p->move_p2.x);
+			h = fitness_hash_float(h, p->move_p2.y);
+		} else {
+			h = fitness_hash_float(h, p->center.x);
+			h = fitness_hash_float(h, p->center.y);
+		}
+	}
+	return h ? h : 1;
+}
+
+static void fitness_cache_clear(State *state) {
+	memset(state->fitness_cache, 0, sizeof state->fitness_cache);
+}
+
+#define FITNESS_CACHE_PROBES 8
+
+// returns true and fills in setup's score and total_time if it's in the cache
+static bool fitness_cache_get(State *state, u64 hash, Setup *setup) {
+	for (u32 i = 0; i < FITNESS_CACHE_PROBES; ++i) {
+		FitnessCacheEntry const *entry = &state->fitness_cache[(hash + i) & (FITNESS_CACHE_SIZE - 1)];
+		if (entry->hash == hash) {
+			setup->score = entry->score;
+			setup->total_time = entry->total_time;
+			return true;
+		}
+		if (!entry->hash) break;
+	}
+	return false;
+}
+
+static void fitness_cache_put(State *state, u64 hash, Setup const *setup) {
+	FitnessCacheEntry *entry = NULL;
+	for (u32 i = 0; i < FITNESS_CACHE_PROBES; ++i) {
+		FitnessCacheEntry *e = &state->fitness_cache[(hash + i) & (FITNESS_CACHE_SIZE - 1)];
+		if (!e->hash || e->hash == hash) {
+			entry = e;
+			break;
+		}
+	}
+	if (!entry) entry = &state->fitness_cache[hash & (FITNESS_CACHE_SIZE - 1)]; // full; replace the first one
+	entry->hash = hash;
+	entry->score = setup->score;
+	entry->total_time = setup->total_time;
+}
+
+// like setups_score_screened, but setups which are in the fitness cache, or which got their parent's score
+// (see incremental.cpp) aren't scored again
+static void setups_score_cached(State *state, Setup *setups, SetupRecord *records, u32 nsetups) {
+	if (!state->fitness_cache_enabled && !state->incremental && !state->checkpoints) {
+		setups_score_screened(state, setups, records, NULL, nsetups, NULL);
+		return;
+	}
+	u64 *hashes = calloc_arr(u64, nsetups);
+	u32 *miss_indices = calloc_arr(u32, nsetups);
+	bool *simulated = calloc_arr(bool, nsetups);
+	if (!hashes || !miss_indices || !simulated) {
+		// out of memory; just score them all
+		free(hashes); free(miss_indices); free(simulated);
+		setups_score_screened(state, setups, records, NULL, nsetups, NULL);
+		return;
+	}
+
+	u32 nmisses = 0;
+	for (u32 i = 0; i < nsetups; ++i) {
+		Setup *setup = &setups[i];
+		if (records && records[i].reused) {
+			++state->incremental_stats.nreused;
+			continue;
+		}
+		if (!state->fitness_cache_enabled) {
+			miss_indices[nmisses++] = i;
+			continue;
+		}
+		hashes[i] = fitness_hash(state, setup);
+		if (fitness_cache_get(state, hashes[i], setup)) {
+			++state->fitness_cache_hits;
+			if (records) records[i].valid = false; // the record is still the parent's
+			setup->pruned = false;
+		} else {
+			++state->fitness_cache_misses;
+			miss_indices[nmisses++] = i;
+		}
+	}
+	setups_score_screened(state, setups, records, miss_indices, nmisses, simulated);
+	if (state->checkpoints) checkpoints_check(state, setups, records, miss_indices, nmisses);
+	for (u32 m = 0; m < nmisses; ++m) {
+		u32 i = miss_indices[m];
+		// don't remember approximate scores from the surrogate, or upper bounds from pruning
+		if (simulated[m] && !setups[i].pruned && state->fitness_cache_enabled) fitness_cache_put(state, hashes[i], &setups[i]);
+	}
+	incremental_verify(state, setups, records, nsetups);
+
+	free(hashes); free(miss_indices); free(simulated);
+}
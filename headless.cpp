@@ -0,0 +1,874 @@
+// entry point for running evolution without a window (no SDL or GL needed)
+#define HEADLESS 1
+#include "sim.cpp"
+#include "island.cpp"
+
+static void usage(void) {
+	fprintf(stderr, "Usage: boxcatapult2d-headless [options]\n"
+		"  -g <generations>  run until this many generations have been done (default: 100)\n"
+		"  -s <seed>         random seed (default: based on the current time)\n"
+		"  -o <directory>    where to save each generation's setups, as top.b2p (default: setups)\n"
+		"  -b2s              also save each of the top setups as <directory>/000.b2s, 001.b2s, ...\n"
+		"  -list <file>      instead of evolving, list the setups in a .b2p or .b2s file (or describe a .b2t file)\n"
+		"  -record <file>    at the end, save everything that happens when the best setup is simulated to file,\n"
+		"                    which can be played back without simulating it again (.b2t)\n"
+		"  -history          add the top setups of every generation to <directory>/history.b2h\n"
+		"                    (with an index of where each generation is in history.idx)\n"
+		"  -history-list <directory>  instead of evolving, show the best setup of every generation in the\n"
+		"                    history in directory (this can be done while the history is being recorded)\n"
+		"  -j <threads>      number of threads to score setups on (default: number of CPUs)\n"
+		"  -n <setups>       number of new setups made each generation (default: 100)\n"
+		"  -top <n>          number of the best setups kept each generation, which new setups are made from\n"
+		"                    (default: 10)\n"
+		"  -groups <groups>  mutation rates new setups are made with, as a comma-separated list of rate[:weight],\n"
+		"                    where \"random\" means a completely random setup and each group gets a share of the\n"
+		"                    new setups proportional to its weight (default: 0.05,0.1,0.2,0.3,random)\n"
+		"  -pareto           keep the setups which are best at throwing the ball far, fast (in as little time as\n"
+		"                    possible) and cheaply (with as little platform as possible) all at once, instead of\n"
+		"                    just far. the best ones seen are saved as pareto_*.b2s, listed in pareto.txt\n"
+		"  -novelty <weight> keep setups which do something new with the ball (land somewhere or take a time which\n"
+		"                    few setups before them have) as well as ones which throw it far: setups are ranked by\n"
+		"                    distance + weight * novelty, where novelty is measured in meters\n"
+		"  -adaptive         give more of the new setups to the mutation groups whose setups have recently been\n"
+		"                    making it into the top, and show how many did from each group every generation\n"
+		"  -run <file>       save the whole population (and everything else needed to carry on) to file every\n"
+		"                    -save-every generations. if the file already exists, carry on from it\n"
+		"                    (with its seed, population size and mutation groups) instead of starting over\n"
+		"  -save-every <n>   with -run, how often to save (default: 10)\n"
+		"  -v                show how long each thread spent scoring/waiting, how many setups didn't need to be\n"
+		"                    simulated because they were the same as one which already had been, and how many\n"
+		"                    setups from each mutation group made it into the top, every generation\n"
+		"  -no-cache         simulate every setup, even if the same setup has already been simulated\n"
+		"  -no-ballistic     always simulate until the ball lands, even once it can't touch a platform again\n"
+		"  -ballistic-compare  every generation, score the setups with and without working out where the ball\n"
+		"                    lands once it can't touch a platform again, and show the differences\n"
+		"  -pool             reuse Box2D bodies (and worlds) between setups. this is faster, but the results\n"
+		"                    then depend on the number of threads\n"
+		"  -incremental      give children their parent's score without simulating them, if the parent's ball\n"
+		"                    didn't go anywhere near the platforms which were mutated\n"
+		"  -incremental-verify <n>  like -incremental, but also simulate n of those children every generation\n"
+		"                    and show how many of them didn't really have their parent's score\n"
+		"  -checkpoints      start simulating children from a checkpoint of their parent's, from before the\n"
+		"                    ball went near anything which was mutated\n"
+		"  -checkpoints-check  like -checkpoints, but also simulate those children from the start, show how\n"
+		"                    many of them got a different score every generation, and fail if any did\n"
+		"  -screen <margin>  don't simulate new setups with Box2D if a (much faster) approximate simulation says\n"
+		"                    they're more than <margin> meters worse than the worst of the top setups\n"
+		"  -screen-report    with -screen, also simulate the setups which were skipped, and show how accurate\n"
+		"                    the approximate simulation was every generation\n"
+		"  -prune            stop simulating new setups as soon as the ball can't possibly end up far enough for\n"
+		"                    them to make it into the top (they then get an upper bound instead of their score)\n"
+		"  -prune-check      like -prune, but also simulate the pruned setups fully, and show how many simulation\n"
+		"                    steps pruning saved, and whether any of them would have made it into the top\n"
+		"  -bench <n>        instead of evolving, score n random setups on one thread with and without -pool\n"
+		"                    and show how many setups per second were scored\n"
+		"  -bench-novelty <n>  instead of evolving, find the nearest neighbours of random behaviours in a novelty\n"
+		"                    archive of n behaviours, with its grid and by checking every one, and show the times\n"
+		"  -bench-load <n>   instead of evolving, write n random setups to one population file (<dir>/load-bench.b2p),\n"
+		"                    then decode it with stdio (a field at a time) and by mapping it, and show how fast each was\n"
+#if __unix__
+		"island mode (run one process per island):\n"
+		"  -island <i>       which island this process is (starting from 0)\n"
+		"  -peers <a,b,...>  addresses of all the islands: socket paths, or host:port for TCP\n"
+		"  -migrate <n>      swap the top setups with neighbouring islands every n generations (default: 10)\n"
+		"  -topology <t>     ring (send to the next island) or full (send to all islands) (default: ring)\n"
+#endif
+		);
+}
+
+// score all the current setups (on this thread) with and without sim->ballistic_exit, and print the differences
+static void ballistic_compare(State *state) {
+	SimContext *sim = &state->sim;
+	u32 nexited = 0;
+	double max_difference = 0, total_difference = 0;
+	double time_ballistic = 0, time_full = 0;
+	for (u32 i = 0; i < state->nsetups; ++i) {
+		Setup ballistic = state->setups[i], full = state->setups[i];
+		struct timespec start = time_get();
+		sim->ballistic_exit = true;
+		setup_score(sim, &ballistic, NULL);
+		nexited += sim->ballistic_exited;
+		time_ballistic += timespec_sub(time_get(), start);
+
+		start = time_get();
+		sim->ballistic_exit = false;
+		setup_score(sim, &full, NULL);
+		time_full += timespec_sub(time_get(), start);
+
+		double difference = fabs((double)ballistic.score - (double)full.score);
+		total_difference += difference;
+		if (difference > max_difference) max_difference = difference;
+	}
+	printf("    ballistic exit used for %u/%u setups; score difference: max %.6fm, mean %.6fm; time: %.3fs vs %.3fs\n",
+		(uint)nexited, (uint)state->nsetups, max_difference,
+		total_difference / state->nsetups, time_ballistic, time_full);
+}
+
+// score nsetups random setups on this thread, with and without body pooling, and print how fast it was
+static void bench_pooling(State *state, u32 nsetups) {
+	Setup *setups = calloc_arr(Setup, nsetups);
+	if (!setups) {
+		fprintf(stderr, "Couldn't allocate memory for %u setups.\n", (uint)nsetups);
+		return;
+	}
+	for (u32 i = 0; i < nsetups; ++i) {
+		Rng rng = setup_rng(state, INITIAL_GENERATION, i);
+		setup_random(state, &rng, &setups[i]);
+	}
+	SimContext *sim = &state->sim;
+	sim->ballistic_exit = state->ballistic_exit;
+	float *scores = calloc_arr(float, nsetups);
+	for (int pool = 0; pool < 2 && scores; ++pool) {
+		sim->pool_bodies = pool;
+		world_destroy(sim);
+		world_create(sim);
+		u32 nchanged = 0;
+		struct timespec start = time_get();
+		for (u32 i = 0; i < nsetups; ++i) {
+			Setup setup = setups[i];
+			setup_score(sim, &setup, NULL);
+			if (pool) nchanged += setup.score != scores[i];
+			else scores[i] = setup.score;
+		}
+		double time = timespec_sub(time_get(), start);
+		printf("%s pooling: %u setups in %.3fs (%.1f setups/s)",
+			pool ? "With" : "Without", (uint)nsetups, time, nsetups / time);
+		if (pool) printf(", %u scores changed", (uint)nchanged);
+		printf("\n");
+	}
+	free(scores);
+	free(setups);
+}
+
+// read a setup written by population_put_setup from fp a field at a time, for bench_load to compare with
+// population_get_setup. returns false if it's invalid.
+static bool bench_read_setup_stdio(FILE *fp, Setup *setup) {
+	setup->score = fread_float(fp);
+	setup->total_time = fread_float(fp);
+	setup->mutations = fread_u64(fp);
+	setup->nplatforms = fread_u32(fp);
+	if (setup->nplatforms > MAX_PLATFORMS) return false;
+	for (u32 j = 0; j < setup->nplatforms; ++j) {
+		Platform *platform = &setup->platforms[j];
+		platform->center = fread_v2(fp);
+		platform->radius = fread_float(fp);
+		platform->start_angle = fread_float(fp);
+		platform->angle = fread_float(fp);
+		u8 flags = fread_u8(fp);
+		platform->moves = (flags & 1) != 0;
+		platform->rotates = (flags & 2) != 0;
+		platform->move_speed = fread_float(fp);
+		platform->move_p1 = fread_v2(fp);
+		platform->move_p2 = fread_v2(fp);
+		platform->rotate_speed = fread_float(fp);
+		platform->color = fread_u32(fp);
+	}
+	return !ferror(fp) && !feof(fp);
+}
+
+// write nsetups random setups to one population file, then decode it with stdio (a field at a time) and
+// by mapping it (population_load), and show how long each took
+static void bench_load(State *state, u32 nsetups) {
+	char filename[600] = {0};
+	snprintf(filename, sizeof filename - 1, "%s/load-bench.b2p", state->output_dir);
+	Setup *setups = calloc_arr(Setup, nsetups), *decoded = calloc_arr(Setup, nsetups);
+	if (!setups || !decoded) {
+		fprintf(stderr, "Out of memory.\n");
+		free(setups); free(decoded);
+		return;
+	}
+	size_t size = POPULATION_HEADER_SIZE;
+	for (u32 i = 0; i < nsetups; ++i) {
+		Rng rng = setup_rng(state, INITIAL_GENERATION, i);
+		setup_random(state, &rng, &setups[i]);
+		size += population_setup_size(&setups[i]);
+	}
+	u8 *data = (u8 *)malloc(size);
+	if (data) {
+		u32 magic = POPULATION_MAGIC, version = POPULATION_VERSION, ntop = 0;
+		u64 file_size = size, generation = 0;
+		u8 *p = data;
+		p = population_put(p, &magic, 4);
+		p = population_put(p, &version, 4);
+		p = population_put(p, &file_size, 8);
+		p = population_put(p, &generation, 8);
+		p = population_put(p, &ntop, 4);
+		p = population_put(p, &nsetups, 4);
+		for (u32 i = 0; i < nsetups; ++i)
+			p = population_put_setup(p, &setups[i]);
+		assert(p == data + size);
+	}
+	if (!data || !file_write_all(filename, data, size)) {
+		fprintf(stderr, "Couldn't write the setups to %s.\n", filename);
+		free(data); free(setups); free(decoded);
+		return;
+	}
+	free(data);
+	printf("%u setups in %s (%.1f MB)\n", (uint)nsetups, filename, (double)size / 1e6);
+
+	// stdio, a field at a time
+	struct timespec start = time_get();
+	u32 nloaded = 0;
+	FILE *fp = fopen(filename, "rb");
+	if (fp) {
+		fseek(fp, POPULATION_HEADER_SIZE, SEEK_SET);
+		while (nloaded < nsetups && bench_read_setup_stdio(fp, &decoded[nloaded]))
+			++nloaded;
+		fclose(fp);
+	}
+	double time = timespec_sub(time_get(), start);
+	printf("stdio: decoded %u/%u setups in %.3fs (%.0f setups/s)\n", (uint)nloaded, (uint)nsetups, time, nloaded / time);
+
+	// mapped
+	start = time_get();
+	Population population = {};
+	bool ok = population_load(&population, filename);
+	time = timespec_sub(time_get(), start);
+	printf("mmap: decoded %u/%u setups in %.3fs (%.0f setups/s)\n", (uint)population.nsetups, (uint)nsetups, time, population.nsetups / time);
+
+	// make sure both ways give exactly the same setups as were written
+	u32 nmismatches = ok && nloaded == nsetups && population.nsetups == nsetups ? 0 : nsetups;
+	for (u32 i = 0; !nmismatches && i < nsetups; ++i) {
+		Setup const *a = &setups[i], *b = &decoded[i], *c = &population.setups[i];
+		nmismatches += a->nplatforms != b->nplatforms || a->nplatforms != c->nplatforms
+			|| memcmp(a->platforms, b->platforms, a->nplatforms * sizeof(Platform)) != 0
+			|| memcmp(a->platforms, c->platforms, a->nplatforms * sizeof(Platform)) != 0;
+	}
+	printf("%u mismatches\n", (uint)nmismatches);
+	population_free(&population);
+	remove(filename);
+	free(setups); free(decoded);
+}
+
+// parse the argument to -groups into groups. returns the number of groups, or 0 if it's invalid.
+static u32 parse_mutation_groups(char const *value, MutationGroup groups[MAX_MUTATION_GROUPS]) {
+	u32 ngroups = 0;
+	char const *p = value;
+	while (*p) {
+		if (ngroups >= MAX_MUTATION_GROUPS) return 0;
+		MutationGroup *group = &groups[ngroups++];
+		if (strncmp(p, "random", 6) == 0) {
+			group->mutation_rate = MUTATION_RANDOM;
+			p += 6;
+		} else {
+			char *end;
+			group->mutation_rate = strtof(p, &end);
+			if (end == p || !(group->mutation_rate >= 0 && group->mutation_rate <= 1)) return 0;
+			p = end;
+		}
+		group->weight = 1;
+		if (*p == ':') {
+			char *end;
+			ulong weight = strtoul(p + 1, &end, 10);
+			if (end == p + 1 || weight < 1 || weight > 1000000) return 0;
+			group->weight = (u32)weight;
+			p = end;
+		}
+		if (*p == ',') ++p;
+		else if (*p) return 0;
+	}
+	return ngroups;
+}
+
+static void mutation_groups_print(State const *state) {
+	printf("    mutation groups (in top/made):");
+	for (u32 g = 0; g < state->nmutation_groups; ++g) {
+		MutationGroup const *group = &state->mutation_groups[g];
+		if (group->mutation_rate == MUTATION_RANDOM)
+			printf(" random");
+		else
+			printf(" %g%%", group->mutation_rate * 100.0f);
+		printf(" %u/%u", (uint)group->yield, (uint)group->nsetups);
+		if (g < state->nmutation_groups - 1) printf(",");
+	}
+	printf("\n");
+}
+
+static void surrogate_print_stats(SurrogateStats const *stats, u32 top_kept, bool report) {
+	printf("    surrogate: skipped %u/%u", (uint)stats->nskipped, (uint)stats->nscreened);
+	if (report && stats->nscreened) {
+		double n = stats->nscreened;
+		double cov = stats->sum_ar / n - (stats->sum_a / n) * (stats->sum_r / n);
+		double var_a = stats->sum_aa / n - (stats->sum_a / n) * (stats->sum_a / n);
+		double var_r = stats->sum_rr / n - (stats->sum_r / n) * (stats->sum_r / n);
+		double correlation = var_a > 0 && var_r > 0 ? cov / sqrt(var_a * var_r) : 0;
+		printf(", %u of them wrongly (they would have made it into the top %u); mean error %.2fm, correlation %.3f",
+			(uint)stats->nwrongly_skipped, (uint)top_kept, stats->total_error / n, correlation);
+	}
+	printf("\n");
+}
+
+// command-line options (see usage)
+typedef struct {
+	i32 generations;
+	ullong seed;
+	char const *output_dir;
+	i32 nthreads;
+	bool verbose;
+	bool no_ballistic_exit;
+	bool ballistic_compare;
+	bool pool_bodies;
+	bool no_fitness_cache;
+	bool incremental;
+	i32 incremental_verify; // negative if -incremental-verify wasn't given
+	bool checkpoints, checkpoints_check;
+	bool prune, prune_check;
+	float surrogate_margin; // negative if -screen wasn't given
+	bool surrogate_report;
+	char const *run_file;
+	i32 save_every;
+	i32 generation_size, top_kept;
+	MutationGroup mutation_groups[MAX_MUTATION_GROUPS];
+	u32 nmutation_groups; // 0 = use the defaults
+	bool adaptive_groups;
+	bool pareto;
+	bool write_b2s;
+	char const *list_file;
+	char const *record_file;
+	bool history;
+	char const *history_list_dir;
+	float novelty_weight; // negative if -novelty wasn't given
+	i32 bench_setups;
+	i32 bench_novelty;
+	i32 bench_load_setups;
+#if __unix__
+	i32 island; // -1 if -island wasn't given
+	char *peers;
+	u32 migrate_every;
+	IslandTopology topology;
+#endif
+} Options;
+
+// options which don't take a value, and the field of Options they set
+static struct {
+	char const *name;
+	size_t offset;
+} const switch_options[] = {
+	{"-v", offsetof(Options, verbose)},
+	{"-no-ballistic", offsetof(Options, no_ballistic_exit)},
+	{"-ballistic-compare", offsetof(Options, ballistic_compare)},
+	{"-screen-report", offsetof(Options, surrogate_report)},
+	{"-history", offsetof(Options, history)},
+	{"-b2s", offsetof(Options, write_b2s)},
+	{"-pareto", offsetof(Options, pareto)},
+	{"-adaptive", offsetof(Options, adaptive_groups)},
+	{"-incremental", offsetof(Options, incremental)},
+	{"-checkpoints", offsetof(Options, checkpoints)},
+	{"-checkpoints-check", offsetof(Options, checkpoints_check)},
+	{"-prune", offsetof(Options, prune)},
+	{"-prune-check", offsetof(Options, prune_check)},
+	{"-no-cache", offsetof(Options, no_fitness_cache)},
+	{"-pool", offsetof(Options, pool_bodies)},
+};
+
+// options which take an integer value, the field of Options they set, and the smallest value allowed
+static struct {
+	char const *name;
+	size_t offset;
+	i32 min;
+} const int_options[] = {
+	{"-g", offsetof(Options, generations), 0},
+	{"-j", offsetof(Options, nthreads), 1},
+	{"-save-every", offsetof(Options, save_every), 1},
+	{"-n", offsetof(Options, generation_size), 1},
+	{"-top", offsetof(Options, top_kept), 1},
+	{"-incremental-verify", offsetof(Options, incremental_verify), 0},
+	{"-bench-novelty", offsetof(Options, bench_novelty), 1},
+	{"-bench-load", offsetof(Options, bench_load_setups), 1},
+	{"-bench", offsetof(Options, bench_setups), 1},
+#if __unix__
+	{"-island", offsetof(Options, island), 0},
+#endif
+};
+
+// options which take a string value, and the field of Options they set
+static struct {
+	char const *name;
+	size_t offset;
+} const string_options[] = {
+	{"-o", offsetof(Options, output_dir)},
+	{"-list", offsetof(Options, list_file)},
+	{"-record", offsetof(Options, record_file)},
+	{"-history-list", offsetof(Options, history_list_dir)},
+	{"-run", offsetof(Options, run_file)},
+};
+
+static void options_default(Options *options) {
+	memset(options, 0, sizeof *options);
+	options->generations = 100;
+	options->seed = (ullong)time(NULL);
+	options->output_dir = "setups";
+	options->nthreads = (i32)thread_cpu_count();
+	options->incremental_verify = -1;
+	options->surrogate_margin = -1;
+	options->save_every = 10;
+	options->generation_size = DEFAULT_GENERATION_SIZE;
+	options->top_kept = DEFAULT_TOP_KEPT;
+	options->novelty_weight = -1;
+#if __unix__
+	options->island = -1;
+	options->migrate_every = 10;
+#endif
+}
+
+// set the option arg, whose value (if it takes one) is value. returns the number of arguments used
+// (1 or 2), or 0 if arg isn't an option, or value is missing or invalid.
+static int option_parse(Options *options, char const *arg, char const *value) {
+	u8 *base = (u8 *)options;
+	for (size_t o = 0; o < arr_count(switch_options); ++o) {
+		if (streq(arg, switch_options[o].name)) {
+			*(bool *)(base + switch_options[o].offset) = true;
+			return 1;
+		}
+	}
+	if (!value) return 0;
+	bool success = false;
+	for (size_t o = 0; o < arr_count(int_options); ++o) {
+		if (streq(arg, int_options[o].name)) {
+			i32 *x = (i32 *)(base + int_options[o].offset);
+			*x = str_to_i32(value, &success);
+			return success && *x >= int_options[o].min ? 2 : 0;
+		}
+	}
+	for (size_t o = 0; o < arr_count(string_options); ++o) {
+		if (streq(arg, string_options[o].name)) {
+			*(char const **)(base + string_options[o].offset) = value;
+			return 2;
+		}
+	}
+	if (streq(arg, "-s")) {
+		success = sscanf(value, "%llu", &options->seed) == 1;
+	} else if (streq(arg, "-groups")) {
+		options->nmutation_groups = parse_mutation_groups(value, options->mutation_groups);
+		success = options->nmutation_groups > 0;
+	} else if (streq(arg, "-screen")) {
+		success = sscanf(value, "%f", &options->surrogate_margin) == 1 && options->surrogate_margin >= 0;
+	} else if (streq(arg, "-novelty")) {
+		success = sscanf(value, "%f", &options->novelty_weight) == 1 && options->novelty_weight >= 0;
+#if __unix__
+	} else if (streq(arg, "-peers")) {
+		options->peers = (char *)value;
+		success = true;
+	} else if (streq(arg, "-migrate")) {
+		i32 migrate_every = str_to_i32(value, &success);
+		success &= migrate_every >= 1;
+		options->migrate_every = (u32)migrate_every;
+	} else if (streq(arg, "-topology")) {
+		success = true;
+		if (streq(value, "ring"))
+			options->topology = ISLAND_TOPOLOGY_RING;
+		else if (streq(value, "full"))
+			options->topology = ISLAND_TOPOLOGY_FULL;
+		else
+			success = false;
+#endif
+	}
+	return success ? 2 : 0;
+}
+
+// parse the command line into options. returns false if it's invalid (after saying why).
+static bool options_parse(Options *options, int argc, char **argv) {
+	options_default(options);
+	for (int i = 1; i < argc; ) {
+		int used = option_parse(options, argv[i], i+1 < argc ? argv[i+1] : NULL);
+		if (!used) {
+			usage();
+			return false;
+		}
+		i += used;
+	}
+	// the -check options (and -incremental-verify) imply the options they check
+	options->checkpoints |= options->checkpoints_check;
+	options->prune |= options->prune_check;
+	options->incremental |= options->incremental_verify >= 0;
+	if (options->pareto && (options->prune || options->surrogate_margin >= 0)) {
+		fprintf(stderr, "-pareto can't be used with -prune or -screen (they only know about distance).\n");
+		return false;
+	}
+	if (options->novelty_weight >= 0 && (options->pareto || options->prune || options->surrogate_margin >= 0)) {
+		fprintf(stderr, "-novelty can't be used with -pareto, -prune or -screen.\n");
+		return false;
+	}
+	return true;
+}
+
+// set up state's settings from options
+static void options_apply(Options const *options, State *state) {
+	str_cpy(state->output_dir, sizeof state->output_dir, options->output_dir);
+	make_directory(state->output_dir);
+	state->write_b2s = options->write_b2s;
+	state->nthreads = (u32)options->nthreads;
+	state->ballistic_exit = !options->no_ballistic_exit;
+	state->pool_bodies = options->pool_bodies;
+	state->fitness_cache_enabled = !options->no_fitness_cache;
+	state->incremental = options->incremental;
+	state->incremental_verify = options->incremental_verify > 0 ? (u32)options->incremental_verify : 0;
+	state->checkpoints = options->checkpoints;
+	state->checkpoints_check = options->checkpoints_check;
+	state->prune = options->prune;
+	state->prune_check = options->prune_check;
+	state->surrogate_screen = options->surrogate_margin >= 0;
+	state->surrogate_margin = options->surrogate_margin;
+	state->surrogate_report = options->surrogate_report;
+	evolution_settings_default(state);
+	state->generation_size = (u32)options->generation_size;
+	state->top_kept = (u32)options->top_kept;
+	if (options->nmutation_groups) {
+		state->nmutation_groups = options->nmutation_groups;
+		memcpy(state->mutation_groups, options->mutation_groups, sizeof options->mutation_groups);
+	}
+	state->adaptive_groups = options->adaptive_groups;
+	state->pareto = options->pareto;
+	state->novelty = options->novelty_weight >= 0;
+	state->novelty_weight = maxf(options->novelty_weight, 0);
+}
+
+// -list: describe a .b2t file, or list the setups in a .b2p or .b2s file. returns the exit code.
+static int list_file(char const *filename) {
+	Trajectory trajectory = {};
+	Setup *recorded = calloc_object(Setup);
+	if (recorded && trajectory_load(&trajectory, recorded, filename)) {
+		float starting_line = platforms_starting_line(recorded->platforms, recorded->nplatforms);
+		SimContext *sim = calloc_object(SimContext);
+		bool valid = sim != NULL;
+		if (sim) {
+			// (trajectory_apply only needs the platforms)
+			memcpy(sim->platforms, recorded->platforms, recorded->nplatforms * sizeof(Platform));
+			sim->nplatforms = recorded->nplatforms;
+			valid = trajectory.nframes > 0 && trajectory_apply(&trajectory, trajectory.nframes - 1, sim);
+		}
+		if (valid)
+			printf("Trajectory of a setup which got %.2fm in %.1fs: %u frames in %u bytes (%.1f bytes per frame); "
+				"the ball ends up %.2fm from the starting line\n", recorded->score, recorded->total_time,
+				(uint)trajectory.nframes, (uint)trajectory.size, (double)trajectory.size / trajectory.nframes,
+				sim->ball.pos.x - starting_line);
+		else
+			printf("Invalid trajectory.\n");
+		free(sim);
+		free(recorded);
+		trajectory_free(&trajectory);
+		return valid ? 0 : EXIT_FAILURE;
+	}
+	free(recorded);
+	Population population = {};
+	if (!population_load(&population, filename)) {
+		fprintf(stderr, "Couldn't read setups from %s.\n", filename);
+		return EXIT_FAILURE;
+	}
+	printf("Generation %llu, %u setups (the first %u are the top ones):\n",
+		(ullong)population.generation, (uint)population.nsetups, (uint)population.ntop);
+	for (u32 i = 0; i < population.nsetups; ++i) {
+		Setup const *setup = &population.setups[i];
+		printf("%3u. %.2fm in %.1fs, %u platforms (mutated %llu times)\n", (uint)i, setup->score,
+			setup->total_time, (uint)setup->nplatforms, (ullong)setup->mutations);
+	}
+	population_free(&population);
+	return 0;
+}
+
+// -history-list: show the best setup of every generation in the history in dir. returns the exit code.
+static int history_list(char const *dir) {
+	HistoryReader reader = {};
+	if (!history_reader_open(&reader, dir)) {
+		fprintf(stderr, "Couldn't read the history in %s.\n", dir);
+		return EXIT_FAILURE;
+	}
+	for (u64 g = 1; g <= reader.ngenerations; ++g) {
+		size_t size = 0;
+		u8 const *record = history_reader_get(&reader, g, &size);
+		Population population = {};
+		if (!record) {
+			printf("Generation %llu: not recorded\n", (ullong)g);
+		} else if (!population_parse(record, size, &population) || population.ntop == 0) {
+			printf("Generation %llu: invalid\n", (ullong)g);
+		} else {
+			Setup const *best = &population.setups[0];
+			printf("Generation %llu: %.2fm in %.1fs (mutated %llu times)\n",
+				(ullong)g, best->score, best->total_time, (ullong)best->mutations);
+		}
+		population_free(&population);
+	}
+	history_reader_close(&reader);
+	return 0;
+}
+
+// -record: save what happens when the best setup is simulated to filename
+static void record_best(State *state, char const *filename) {
+	Trajectory trajectory = {};
+	Setup *setup = calloc_object(Setup);
+	bool success = setup != NULL;
+	if (success) {
+		*setup = *setup_top(state, 0);
+		success = trajectory_record(&state->sim, setup, &trajectory)
+			&& trajectory_write_to_file(&trajectory, setup, filename);
+	}
+	if (success) {
+		u32 nvalues = trajectory_nvalues(&trajectory);
+		printf("Recorded %u frames in %u bytes (%.1f bytes per frame, vs %u as floats).\n",
+			(uint)trajectory.nframes, (uint)trajectory.size, (double)trajectory.size / trajectory.nframes,
+			(uint)(nvalues * sizeof(float)));
+	} else {
+		fprintf(stderr, "Couldn't record the best setup to %s.\n", filename);
+	}
+	free(setup);
+	trajectory_free(&trajectory);
+}
+
+// what -v shows every generation. the counters are totals, so the ones from the last generation are passed in.
+static void verbose_print_stats(State const *state, u64 cache_hits, u64 cache_misses, double write_wait_time) {
+	for (u32 t = 0; t < state->nthread_stats; ++t) {
+		ScoringThreadStats const *stats = &state->thread_stats[t];
+		printf("    thread %u: scored %u (%u stolen), busy %.3fs, idle %.3fs\n",
+			(uint)t, (uint)stats->nscored, (uint)stats->nstolen, stats->busy_time, stats->idle_time);
+	}
+	if (state->fitness_cache_enabled)
+		printf("    fitness cache: %llu hits, %llu misses\n",
+			(ullong)(state->fitness_cache_hits - cache_hits), (ullong)(state->fitness_cache_misses - cache_misses));
+	printf("    writer: waited %.3fs for files to be written\n", state->writer.wait_time - write_wait_time);
+}
+
+static void incremental_print_stats(IncrementalStats const *stats, u32 generation_size, bool verify) {
+	printf("    incremental: %u/%u setups got their parent's score", (uint)stats->nreused, (uint)generation_size);
+	if (verify)
+		printf("; simulated %u of them to check: %u mismatches (max difference %.6fm)",
+			(uint)stats->nverified, (uint)stats->nmismatches, stats->max_difference);
+	printf("\n");
+}
+
+static void checkpoints_print_stats(CheckpointStats const *stats, bool check) {
+	printf("    checkpoints: %u setups started from a checkpoint, skipping %.1f%% of time steps",
+		(uint)stats->nresumed, stats->nsteps ? 100.0 * (double)stats->nsteps_skipped / (double)stats->nsteps : 0.0);
+	if (check)
+		printf("; %u mismatches with simulating from the start (max difference %.6fm)",
+			(uint)stats->nmismatches, stats->max_difference);
+	printf("\n");
+}
+
+static void prune_print_stats(PruneStats const *stats, bool check) {
+	printf("    prune: pruned %u/%u simulated setups (%llu steps simulated in all)",
+		(uint)stats->npruned, (uint)stats->nsetups, (ullong)stats->nsteps);
+	u32 ncompleted = stats->nsetups - stats->npruned;
+	if (ncompleted && stats->npruned) {
+		// guess that the pruned setups would have taken as many steps as the others did on average
+		double mean_steps = (double)(stats->nsteps - stats->nsteps_pruned) / ncompleted;
+		double saved = stats->npruned * mean_steps - (double)stats->nsteps_pruned;
+		if (saved < 0) saved = 0;
+		printf("; saved about %.1f%% of the steps", 100.0 * saved / ((double)stats->nsteps + saved));
+	}
+	if (check) {
+		u64 nsteps_full = stats->nsteps + stats->nsteps_saved;
+		printf("; really saved %.1f%% (simulating the pruned ones again), %u of them would have made it into the top",
+			nsteps_full ? 100.0 * (double)stats->nsteps_saved / (double)nsteps_full : 0.0, (uint)stats->nwrong);
+	}
+	printf("\n");
+}
+
+static void pareto_print_stats(State const *state) {
+	float archive_best[3] = {-INFINITY, INFINITY, INFINITY};
+	for (u32 i = 0; i < state->npareto_archive; ++i) {
+		Setup const *setup = &state->pareto_archive[i];
+		archive_best[0] = maxf(archive_best[0], setup->score);
+		archive_best[1] = minf(archive_best[1], setup->total_time);
+		archive_best[2] = minf(archive_best[2], platforms_cost(setup->platforms, setup->nplatforms));
+	}
+	printf("    pareto: %u of the top setups are in the first front; archive of %u: furthest %.2fm, fastest %.2fs, cheapest %.2f\n",
+		(uint)state->pareto_front_size, (uint)state->npareto_archive, archive_best[0], archive_best[1], archive_best[2]);
+}
+
+static void novelty_print_stats(State const *state) {
+	NoveltyArchive const *archive = &state->novelty_archive;
+	float furthest = -INFINITY, most_novel = 0;
+	for (u32 r = 0; r < state->top_kept; ++r) {
+		Setup const *setup = &state->setups[state->top[r]];
+		furthest = maxf(furthest, setup->score);
+		most_novel = maxf(most_novel, setup->novelty);
+	}
+	printf("    novelty: archive of %u (%u added, threshold now %.3f); top setups: furthest %.2fm, most novel %.3f\n",
+		(uint)archive->n, (uint)archive->nadded, archive->add_threshold, furthest, most_novel);
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!options_parse(&options, argc, argv))
+		return EXIT_FAILURE;
+	if (options.list_file)
+		return list_file(options.list_file);
+	if (options.history_list_dir)
+		return history_list(options.history_list_dir);
+	if (options.bench_novelty) {
+		novelty_bench((u32)options.bench_novelty, 100000);
+		return 0;
+	}
+
+#if __unix__
+	Islands islands = {};
+	islands.migrate_every = options.migrate_every;
+	islands.topology = options.topology;
+	islands.listen_fd = -1;
+	if ((options.island >= 0) != (options.peers != NULL)) {
+		fprintf(stderr, "-island and -peers must be used together.\n");
+		return EXIT_FAILURE;
+	}
+	if (options.peers) {
+		for (char *address = strtok(options.peers, ","); address; address = strtok(NULL, ",")) {
+			if (islands.nislands >= MAX_ISLANDS) {
+				fprintf(stderr, "Too many islands (maximum is %d).\n", MAX_ISLANDS);
+				return EXIT_FAILURE;
+			}
+			islands.addresses[islands.nislands++] = address;
+		}
+		if ((u32)options.island >= islands.nislands) {
+			fprintf(stderr, "Island %d doesn't have an address in -peers.\n", (int)options.island);
+			return EXIT_FAILURE;
+		}
+		islands.index = (u32)options.island;
+	}
+#endif
+
+	State *state = calloc_object(State);
+	if (!state) {
+		fprintf(stderr, "Couldn't allocate memory (%lu bytes).\n", (ulong)sizeof(State));
+		return EXIT_FAILURE;
+	}
+
+	state->seed = options.seed;
+	printf("Seed: %llu\n", options.seed);
+#if __unix__
+	// each island needs its own random numbers
+	if (islands.nislands > 1) state->seed = hash_u64(options.seed + islands.index);
+#endif
+	options_apply(&options, state);
+	sim_init(&state->sim);
+
+#if __unix__
+	if (islands.nislands > 1) {
+		printf("Island %u of %u, waiting for the other islands...\n", (uint)islands.index, (uint)islands.nislands);
+		fflush(stdout);
+		if (!islands_connect(&islands)) {
+			islands_disconnect(&islands);
+			return EXIT_FAILURE;
+		}
+	}
+#endif
+
+	if (options.bench_load_setups) {
+		bench_load(state, (u32)options.bench_load_setups);
+		sim_free(&state->sim);
+		free(state);
+		return 0;
+	}
+	if (options.bench_setups) {
+		bench_pooling(state, (u32)options.bench_setups);
+		sim_free(&state->sim);
+		free(state);
+		return 0;
+	}
+
+	char const *run_file = options.run_file;
+	struct timespec start_time = time_get();
+	bool resumed = run_file && file_exists(run_file);
+	if (resumed) {
+		if (!run_load(state, run_file)) {
+			fprintf(stderr, "Couldn't carry on from %s (it's invalid, or there isn't enough memory).\n", run_file);
+			return EXIT_FAILURE;
+		}
+		// (the file decides whether it's a -pareto or -novelty run, whatever options were given)
+		if ((state->pareto || state->novelty) && (state->prune || state->surrogate_screen)) {
+			fprintf(stderr, "%s is a %s run, which can't be carried on with -prune or -screen.\n",
+				run_file, state->pareto ? "-pareto" : "-novelty");
+			return EXIT_FAILURE;
+		}
+		printf("Carrying on from generation %llu in %s (seed %llu, %u new setups and %u kept each generation%s).\n",
+			(ullong)state->generation, run_file, (ullong)state->seed,
+			(uint)state->generation_size, (uint)state->top_kept,
+			state->pareto ? ", Pareto" : state->novelty ? ", novelty" : "");
+	} else if (!start_evolution(state)) {
+		fprintf(stderr, "Couldn't allocate memory for %u setups.\n", (uint)(state->top_kept + state->generation_size));
+		return EXIT_FAILURE;
+	}
+	if (options.history && !history_open(&state->history, state->output_dir, state->generation, resumed)) {
+		fprintf(stderr, "Couldn't record the history in %s (if there's already one there, from another run,\n"
+			"carry that run on with -run, or use a different directory).\n", state->output_dir);
+		return EXIT_FAILURE;
+	}
+	// (this is only started now, so that none of the failures above leave it running with files to write)
+	writer_start(&state->writer);
+	u64 generations = (u64)options.generations;
+	u64 cache_hits = 0, cache_misses = 0;
+	double write_wait_time = 0;
+	u64 checkpoint_mismatches = 0;
+	while (state->generation < generations) {
+		start_generation(state);
+		score_generation(state);
+#if __unix__
+		if (islands.nislands > 1 && state->generation % islands.migrate_every == 0)
+			islands_migrate(&islands, state);
+#endif
+		Setup *best = setup_top(state, 0);
+		printf("Generation %llu: %.2fm in %.1fs (mutated %llu times) [%.1fs elapsed]\n",
+			(ullong)state->generation, best->score, best->total_time, (ullong)best->mutations,
+			timespec_sub(time_get(), start_time));
+		if (options.verbose)
+			verbose_print_stats(state, cache_hits, cache_misses, write_wait_time);
+		write_wait_time = state->writer.wait_time;
+		cache_hits = state->fitness_cache_hits;
+		cache_misses = state->fitness_cache_misses;
+		if (options.verbose || state->adaptive_groups)
+			mutation_groups_print(state);
+		if (options.ballistic_compare)
+			ballistic_compare(state);
+		if (state->incremental) {
+			incremental_print_stats(&state->incremental_stats, state->generation_size, state->incremental_verify != 0);
+			memset(&state->incremental_stats, 0, sizeof state->incremental_stats);
+		}
+		if (state->checkpoints) {
+			checkpoints_print_stats(&state->checkpoint_stats, state->checkpoints_check);
+			checkpoint_mismatches += state->checkpoint_stats.nmismatches;
+			memset(&state->checkpoint_stats, 0, sizeof state->checkpoint_stats);
+		}
+		if (state->prune) {
+			prune_print_stats(&state->prune_stats, state->prune_check);
+			memset(&state->prune_stats, 0, sizeof state->prune_stats);
+		}
+		if (state->surrogate_screen) {
+			surrogate_print_stats(&state->surrogate_stats, state->top_kept, state->surrogate_report);
+			memset(&state->surrogate_stats, 0, sizeof state->surrogate_stats);
+		}
+		if (state->pareto)
+			pareto_print_stats(state);
+		if (state->novelty)
+			novelty_print_stats(state);
+		if (run_file && (state->generation % (u64)options.save_every == 0 || state->generation == generations)) {
+			if (!run_save(state, run_file))
+				fprintf(stderr, "Couldn't save the run to %s.\n", run_file);
+		}
+		fflush(stdout);
+	}
+
+	if (options.record_file)
+		record_best(state, options.record_file);
+	if (state->pareto && !pareto_archive_write(state))
+		fprintf(stderr, "Couldn't write the Pareto archive to %s.\n", state->output_dir);
+
+	writer_stop(&state->writer);
+	history_close(&state->history);
+	if (state->writer.nfailed)
+		fprintf(stderr, "Couldn't write %d of the %llu files saved in %s.\n", (int)state->writer.nfailed,
+			(ullong)state->writer.nwritten, state->output_dir);
+	if (options.verbose)
+		printf("Waited %.3fs in all for files to be written.\n", state->writer.wait_time);
+
+#if __unix__
+	islands_disconnect(&islands);
+#endif
+	scoring_threads_free(state);
+	sim_free(&state->sim);
+	evolution_free(state);
+	free(state);
+	if (checkpoint_mismatches) {
+		fprintf(stderr, "%llu setups got a different score when they were simulated from a checkpoint.\n",
+			(ullong)checkpoint_mismatches);
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
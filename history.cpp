@@ -0,0 +1,174 @@
+/*
+History files: the top setups of every generation of a run, so that you can look at how it got where it is.
+history.b2h is a header followed by one record per generation, each of which is a population file
+(see population.cpp) with just the top setups in it. It's only ever appended to.
+history.idx is a header followed by the offset in history.b2h of each generation's record, generation g's
+being at HISTORY_INDEX_HEADER_SIZE + 8 * (g - 1) (or HISTORY_NOT_RECORDED if it wasn't recorded),
+so readers can map both files and go straight to any generation without looking at the others.
+
+Records are written before their index entries, so a reader which maps history.idx and then history.b2h
+(like history_reader_open) only sees generations which have been completely written, even while the run
+is still going. Opening the reader again picks up the generations added since.
+If a run is carried on from a run file saved before the end of its history, the index is cut back to
+that generation. The records after it are left in history.b2h, but nothing points to them anymore.
+A new run won't touch a history which already has generations in it, since it would be cut back to nothing.
+*/
+
+#define HISTORY_MAGIC 0x48533242 // "B2SH"
+#define HISTORY_INDEX_MAGIC 0x49533242 // "B2SI"
+#define HISTORY_VERSION 1
+#define HISTORY_HEADER_SIZE 8
+#define HISTORY_INDEX_HEADER_SIZE 8
+#define HISTORY_NOT_RECORDED 0
+
+static void history_filenames(char const *dir, char data_filename[512], char index_filename[512]) {
+	snprintf(data_filename, 511, "%s/history.b2h", dir);
+	snprintf(index_filename, 511, "%s/history.idx", dir);
+	data_filename[511] = index_filename[511] = 0;
+}
+
+// returns true if filename doesn't exist, is empty, or starts with the header for magic
+static bool history_header_ok(char const *filename, u32 magic) {
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) return true;
+	u32 header[2] = {0};
+	size_t n = fread(header, 1, sizeof header, fp);
+	fclose(fp);
+	return n == 0 || (n == sizeof header && header[0] == magic && header[1] == HISTORY_VERSION);
+}
+
+static bool history_write_header(FILE *fp, u32 magic) {
+	u32 header[2] = {magic, HISTORY_VERSION};
+	return fwrite(header, sizeof header, 1, fp) == 1;
+}
+
+static void history_close(History *history) {
+	if (history->data_fp) fclose(history->data_fp);
+	if (history->index_fp) fclose(history->index_fp);
+	memset(history, 0, sizeof *history);
+}
+
+// start recording the history in dir (creating it if it doesn't exist), carrying on after generation.
+// resumed should be set if the run was carried on from a run file; if it isn't, there mustn't already be
+// any generations in the history. returns false if the history couldn't be opened, or isn't a history.
+static bool history_open(History *history, char const *dir, u64 generation, bool resumed) {
+	char data_filename[512], index_filename[512];
+	history_filenames(dir, data_filename, index_filename);
+	memset(history, 0, sizeof *history);
+	if (!history_header_ok(data_filename, HISTORY_MAGIC) || !history_header_ok(index_filename, HISTORY_INDEX_MAGIC)) {
+		logln("%s or %s isn't a history file.", data_filename, index_filename);
+		return false;
+	}
+	history->data_fp = fopen(data_filename, "ab");
+	history->index_fp = fopen(index_filename, "ab");
+	u64 index_size = 0;
+	bool ok = history->data_fp && history->index_fp
+		&& file_size(history->data_fp, &history->data_size) && file_size(history->index_fp, &index_size);
+	if (ok && history->data_size == 0) {
+		ok = history_write_header(history->data_fp, HISTORY_MAGIC);
+		history->data_size = HISTORY_HEADER_SIZE;
+	}
+	if (ok && index_size == 0) {
+		ok = history_write_header(history->index_fp, HISTORY_INDEX_MAGIC);
+		index_size = HISTORY_INDEX_HEADER_SIZE;
+	}
+	ok = ok && index_size >= HISTORY_INDEX_HEADER_SIZE && (index_size - HISTORY_INDEX_HEADER_SIZE) % 8 == 0;
+	// make sure the index has an entry for every generation up to this one, and no more
+	u64 nentries = ok ? (index_size - HISTORY_INDEX_HEADER_SIZE) / 8 : 0;
+	if (ok && nentries && !resumed) {
+		logln("%s already has a history in it, from another run.", dir);
+		ok = false;
+	}
+	if (ok && nentries > generation)
+		ok = file_truncate(history->index_fp, HISTORY_INDEX_HEADER_SIZE + 8 * generation);
+	u64 not_recorded = HISTORY_NOT_RECORDED;
+	for (; ok && nentries < generation; ++nentries)
+		ok = fwrite(&not_recorded, sizeof not_recorded, 1, history->index_fp) == 1;
+	ok = ok && fflush(history->data_fp) == 0 && fflush(history->index_fp) == 0;
+	if (!ok) {
+		logln("Couldn't open history in %s.", dir);
+		history_close(history);
+	}
+	return ok;
+}
+
+// add a generation's record (built by population_build) to the history. this is called by the writer thread.
+static bool history_append(History *history, u8 const *record, size_t size) {
+	if (history->failed) return false;
+	u64 offset = history->data_size;
+	bool ok = fwrite(record, 1, size, history->data_fp) == size && fflush(history->data_fp) == 0;
+	history->data_size += size;
+	// (the record has been flushed, so any reader which can see this entry can see all of the record)
+	ok = ok && fwrite(&offset, sizeof offset, 1, history->index_fp) == 1 && fflush(history->index_fp) == 0;
+	if (!ok) {
+		// the index would be out of step with the generations now, so give up
+		logln("Couldn't add to history. It won't be recorded anymore.");
+		history->failed = true;
+	}
+	return ok;
+}
+
+// add the top setups of the generation that's just finished to the history (on the writer thread).
+// this should be called after state->generation has been incremented.
+static void history_record(State *state) {
+	size_t size = 0;
+	u8 *data = population_build(state, true, &size);
+	if (data)
+		writer_submit(&state->writer, NULL, &state->history, data, size);
+}
+
+typedef struct {
+	MappedFile index, data;
+	u64 ngenerations; // the index has entries for generations 1 to ngenerations
+} HistoryReader;
+
+static void history_reader_close(HistoryReader *reader) {
+	file_unmap(&reader->index);
+	file_unmap(&reader->data);
+	reader->ngenerations = 0;
+}
+
+// map the history in dir. this can be done while it's being recorded.
+// returns false if it doesn't exist or isn't a history.
+static bool history_reader_open(HistoryReader *reader, char const *dir) {
+	char data_filename[512], index_filename[512];
+	history_filenames(dir, data_filename, index_filename);
+	memset(reader, 0, sizeof *reader);
+	// (the index has to be mapped first. see the comment at the top of this file.)
+	bool ok = file_map(&reader->index, index_filename) && file_map(&reader->data, data_filename)
+		&& reader->index.size >= HISTORY_INDEX_HEADER_SIZE && reader->data.size >= HISTORY_HEADER_SIZE;
+	if (ok) {
+		u32 index_header[2], data_header[2];
+		memcpy(index_header, reader->index.data, sizeof index_header);
+		memcpy(data_header, reader->data.data, sizeof data_header);
+		ok = index_header[0] == HISTORY_INDEX_MAGIC && index_header[1] == HISTORY_VERSION
+			&& data_header[0] == HISTORY_MAGIC && data_header[1] == HISTORY_VERSION;
+	}
+	if (!ok) {
+		history_reader_close(reader);
+		return false;
+	}
+	reader->ngenerations = (reader->index.size - HISTORY_INDEX_HEADER_SIZE) / 8;
+	return true;
+}
+
+// the record of the given generation (a population file, which can be read with population_parse),
+// or NULL if it wasn't recorded or is invalid.
+static u8 const *history_reader_get(HistoryReader const *reader, u64 generation, size_t *size) {
+	*size = 0;
+	if (generation < 1 || generation > reader->ngenerations) return NULL;
+	u64 offset = 0;
+	memcpy(&offset, reader->index.data + HISTORY_INDEX_HEADER_SIZE + 8 * (generation - 1), sizeof offset);
+	if (offset < HISTORY_HEADER_SIZE || offset > reader->data.size || reader->data.size - offset < POPULATION_HEADER_SIZE)
+		return NULL;
+	u8 const *record = reader->data.data + offset;
+	u32 magic = 0;
+	u64 record_size = 0, record_generation = 0;
+	memcpy(&magic, record, 4);
+	memcpy(&record_size, record + 8, 8);
+	memcpy(&record_generation, record + 16, 8);
+	if (magic != POPULATION_MAGIC || record_size > reader->data.size - offset || record_generation != generation)
+		return NULL;
+	*size = (size_t)record_size;
+	return record;
+}
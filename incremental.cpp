@@ -0,0 +1,171 @@
+/*
+Incremental scoring: if a child only differs from its parent in platforms which the ball never touched,
+and which never got anywhere near the ball's path, the ball does exactly the same thing, so the child can
+just get its parent's score instead of being simulated.
+Even if the ball does get near a mutated platform, it does the same thing up until then, so the child
+can start from one of its parent's checkpoints from before that (this is State.checkpoints).
+*/
+
+// extra room around the ball's path. Box2D starts keeping track of pairs of bodies a bit before they touch
+// (its bounding boxes are enlarged), so this is a lot more than the platforms' skin.
+#define INCREMENTAL_MARGIN 0.5f
+
+// do these platforms behave the same in the simulation?
+static bool platforms_same(Platform const *a, Platform const *b) {
+	if (a->moves != b->moves || a->rotates != b->rotates || a->radius != b->radius
+		|| a->start_angle != b->start_angle || a->angle != b->angle || a->rotate_speed != b->rotate_speed)
+		return false;
+	if (a->moves)
+		return a->move_speed == b->move_speed && v2_eq(a->move_p1, b->move_p1) && v2_eq(a->move_p2, b->move_p2);
+	else
+		return v2_eq(a->center, b->center);
+}
+
+// bit i is set if platform i is different in a and b
+static u32 setups_changed_platforms(Setup const *a, Setup const *b) {
+	u32 changed = 0;
+	for (u32 i = 0; i < a->nplatforms && i < b->nplatforms; ++i)
+		if (!platforms_same(&a->platforms[i], &b->platforms[i]))
+			changed |= (u32)1 << i;
+	return changed;
+}
+
+// everywhere the old or new version of a platform can go, with enough room around it for the ball
+static Rect incremental_swept_box(State const *state, Platform const *old_platform, Platform const *new_platform) {
+	float margin = BALL_RADIUS + state->sim.platform_thickness + INCREMENTAL_MARGIN;
+	Rect swept = rect_union(platform_bounding_box(old_platform), platform_bounding_box(new_platform));
+	return rect4(rect_x1(swept) - margin, rect_y1(swept) - margin, rect_x2(swept) + margin, rect_y2(swept) + margin);
+}
+
+// can child just get parent's score? record is what happened when parent was simulated.
+static bool incremental_can_reuse(State const *state, Setup const *parent, SetupRecord const *record, Setup const *child) {
+	if (!record->valid || parent->nplatforms != child->nplatforms)
+		return false;
+	// the score is measured from the starting line (and where the ballistic exit starts depends on it)
+	if (platforms_starting_line(parent->platforms, parent->nplatforms) != platforms_starting_line(child->platforms, child->nplatforms))
+		return false;
+	for (u32 i = 0; i < child->nplatforms; ++i) {
+		Platform const *a = &parent->platforms[i], *b = &child->platforms[i];
+		if (platforms_same(a, b)) continue;
+		if (record->touched & ((u32)1 << i)) return false;
+		Rect swept = incremental_swept_box(state, a, b);
+		for (u32 j = 0; j < record->nboxes; ++j)
+			if (rects_intersect(swept, record->boxes[j]))
+				return false;
+	}
+	return true;
+}
+
+// which of parent's checkpoints child can start simulating from, plus 1 (0 means it has to start from the start).
+// *replay is set to the platforms which are different from the ones the checkpoint was taken with.
+static u32 incremental_resume_checkpoint(State const *state, Setup const *parent, SetupRecord const *record, Setup const *child, u32 *replay) {
+	if (!record->valid || !record->ncheckpoints || parent->nplatforms != child->nplatforms)
+		return 0;
+	float parent_line = platforms_starting_line(parent->platforms, parent->nplatforms);
+	float child_line = platforms_starting_line(child->platforms, child->nplatforms);
+	Rect swept[MAX_PLATFORMS];
+	u32 nswept = 0;
+	u32 changed = setups_changed_platforms(parent, child);
+	for (u32 i = 0; i < child->nplatforms; ++i)
+		if (changed & ((u32)1 << i))
+			swept[nswept++] = incremental_swept_box(state, &parent->platforms[i], &child->platforms[i]);
+	// (if the parent got its score from its parent, some of its platforms might already be different)
+	*replay = record->resume_replay | changed;
+	// find the first box of the parent's path where the child might do something different
+	u32 j;
+	for (j = 0; j < record->nboxes; ++j) {
+		Rect box = record->boxes[j];
+		bool diverges = false;
+		for (u32 s = 0; s < nswept && !diverges; ++s)
+			diverges = rects_intersect(swept[s], box);
+		// the child's ballistic exit could happen earlier than the parent's
+		if (child_line < parent_line && rect_x2(box) + BALL_RADIUS + INCREMENTAL_MARGIN >= child_line)
+			diverges = true;
+		if (diverges) break;
+	}
+	u32 diverge_step = j * record->steps_per_box; // first step in box j
+	u32 c = record->ncheckpoints;
+	while (c && record->checkpoints[c-1].step > diverge_step)
+		--c;
+	return c;
+}
+
+// simulate (up to) state->incremental_verify of the setups which got their parent's score, to check them
+static void incremental_verify(State *state, Setup const *setups, SetupRecord const *records, u32 nsetups) {
+	u32 nsample = state->incremental_verify;
+	if (!nsample || !records) return;
+	u32 nreused = 0;
+	for (u32 i = 0; i < nsetups; ++i)
+		nreused += records[i].reused;
+	if (!nreused) return;
+	if (nsample > nreused) nsample = nreused;
+	Setup *sample = calloc_arr(Setup, nsample);
+	u32 *sample_indices = calloc_arr(u32, nsample);
+	if (!sample || !sample_indices) {
+		free(sample); free(sample_indices);
+		return;
+	}
+	// spread the sample out evenly
+	u32 n = 0, r = 0;
+	for (u32 i = 0; i < nsetups && n < nsample; ++i) {
+		if (!records[i].reused) continue;
+		if ((u64)r * nsample / nreused == n) {
+			sample_indices[n] = i;
+			sample[n++] = setups[i];
+		}
+		++r;
+	}
+	setups_score_parallel(state, sample, NULL, NULL, n);
+	IncrementalStats *stats = &state->incremental_stats;
+	for (u32 s = 0; s < n; ++s) {
+		float reused_score = setups[sample_indices[s]].score;
+		float difference = fabsf(sample[s].score - reused_score);
+		++stats->nverified;
+		if (sample[s].score != reused_score) ++stats->nmismatches;
+		if (difference > stats->max_difference) stats->max_difference = difference;
+	}
+	free(sample); free(sample_indices);
+}
+
+// add up stats about setups[indices[0..nsetups)], which were just simulated (see State.checkpoint_stats),
+// and if state->checkpoints_check is set, simulate the ones which were resumed from the start to check them
+static void checkpoints_check(State *state, Setup const *setups, SetupRecord const *records, u32 const *indices, u32 nsetups) {
+	if (!records) return;
+	CheckpointStats *stats = &state->checkpoint_stats;
+	u32 nresumed = 0;
+	for (u32 i = 0; i < nsetups; ++i) {
+		SetupRecord const *record = &records[indices[i]];
+		if (!record->valid) continue;
+		stats->nsteps += record->nsteps;
+		if (record->resumed_step) {
+			++nresumed;
+			stats->nsteps_skipped += record->resumed_step;
+		}
+	}
+	stats->nresumed += nresumed;
+	if (!state->checkpoints_check || !nresumed) return;
+
+	Setup *cold = calloc_arr(Setup, nresumed);
+	u32 *cold_indices = calloc_arr(u32, nresumed);
+	if (!cold || !cold_indices) {
+		free(cold); free(cold_indices);
+		return;
+	}
+	u32 n = 0;
+	for (u32 i = 0; i < nsetups; ++i) {
+		u32 s = indices[i];
+		if (records[s].valid && records[s].resumed_step) {
+			cold_indices[n] = s;
+			cold[n++] = setups[s];
+		}
+	}
+	setups_score_parallel(state, cold, NULL, NULL, n);
+	for (u32 c = 0; c < n; ++c) {
+		float resumed_score = setups[cold_indices[c]].score;
+		float difference = fabsf(cold[c].score - resumed_score);
+		++stats->nchecked;
+		if (cold[c].score != resumed_score) ++stats->nmismatches;
+		if (difference > stats->max_difference) stats->max_difference = difference;
+	}
+	free(cold); free(cold_indices);
+}
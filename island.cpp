@@ -0,0 +1,244 @@
+/*
+Island model: several evolution processes ("islands"), each with its own population, which every so often
+send their top setups (State.top_kept of them) to their neighbours. The islands talk to each other over
+Unix domain sockets (for islands on the same machine) or TCP.
+Setups are sent in the same format as .b2s files.
+*/
+#if __unix__
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+
+#define MAX_ISLANDS 64
+#define ISLAND_MAGIC 0x444c5349 // "ISLD"
+
+typedef enum {
+	ISLAND_TOPOLOGY_RING, // send to the next island, receive from the previous one
+	ISLAND_TOPOLOGY_FULL  // send to and receive from every other island
+} IslandTopology;
+
+typedef struct {
+	u32 index; // which island this is
+	u32 nislands;
+	// address of each island. if it has a / in it, it's the path of a Unix domain socket. otherwise, it's host:port.
+	char const *addresses[MAX_ISLANDS];
+	u32 migrate_every; // migrate every this many generations
+	IslandTopology topology;
+
+	int listen_fd;
+	FILE *out[MAX_ISLANDS]; // connections to the islands we send setups to
+	FILE *in[MAX_ISLANDS]; // connections to the islands we receive setups from
+} Islands;
+
+static bool island_sends_to(Islands const *islands, u32 other) {
+	if (other == islands->index) return false;
+	switch (islands->topology) {
+	case ISLAND_TOPOLOGY_RING: return other == (islands->index + 1) % islands->nislands;
+	case ISLAND_TOPOLOGY_FULL: return true;
+	}
+	return false;
+}
+
+static bool island_receives_from(Islands const *islands, u32 other) {
+	if (other == islands->index) return false;
+	switch (islands->topology) {
+	case ISLAND_TOPOLOGY_RING: return islands->index == (other + 1) % islands->nislands;
+	case ISLAND_TOPOLOGY_FULL: return true;
+	}
+	return false;
+}
+
+// create a socket for the given address. if listen is true, it will be bound to the address and listened on,
+// otherwise it will be connected to the address. returns -1 on failure.
+static int island_socket(char const *address, bool listen_on_it, u32 backlog) {
+	if (strchr(address, '/')) {
+		// Unix domain socket
+		struct sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if (strlen(address) >= sizeof addr.sun_path) {
+			fprintf(stderr, "Socket path too long: %s.\n", address);
+			return -1;
+		}
+		str_cpy(addr.sun_path, sizeof addr.sun_path, address);
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) return -1;
+		int ret;
+		if (listen_on_it) {
+			unlink(address); // get rid of socket from last time
+			ret = bind(fd, (struct sockaddr *)&addr, sizeof addr);
+			if (ret == 0) ret = listen(fd, (int)backlog);
+		} else {
+			ret = connect(fd, (struct sockaddr *)&addr, sizeof addr);
+		}
+		if (ret != 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	} else {
+		// TCP
+		char host[256] = {0};
+		str_cpy(host, sizeof host, address);
+		char *colon = strrchr(host, ':');
+		if (!colon) {
+			fprintf(stderr, "Bad island address (should be a socket path or host:port): %s.\n", address);
+			return -1;
+		}
+		*colon = '\0';
+		char const *port = colon + 1;
+		struct addrinfo hints = {}, *addrs = NULL;
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (listen_on_it) hints.ai_flags = AI_PASSIVE;
+		if (getaddrinfo(*host ? host : NULL, port, &hints, &addrs) != 0)
+			return -1;
+		int fd = -1;
+		for (struct addrinfo *a = addrs; a; a = a->ai_next) {
+			fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+			if (fd < 0) continue;
+			int ret;
+			if (listen_on_it) {
+				int yes = 1;
+				setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+				ret = bind(fd, a->ai_addr, a->ai_addrlen);
+				if (ret == 0) ret = listen(fd, (int)backlog);
+			} else {
+				ret = connect(fd, a->ai_addr, a->ai_addrlen);
+			}
+			if (ret == 0) break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(addrs);
+		return fd;
+	}
+}
+
+// listen on our address and connect to our neighbours. returns false on failure.
+static bool islands_connect(Islands *islands) {
+	u32 n = islands->nislands;
+	signal(SIGPIPE, SIG_IGN); // we want an error from fwrite instead if a neighbour disappears
+
+	islands->listen_fd = island_socket(islands->addresses[islands->index], true, n);
+	if (islands->listen_fd < 0) {
+		fprintf(stderr, "Couldn't listen on %s: %s.\n", islands->addresses[islands->index], strerror(errno));
+		return false;
+	}
+
+	// connect to the islands we send to. they might not have started yet, so keep trying for a minute.
+	for (u32 i = 0; i < n; ++i) {
+		if (!island_sends_to(islands, i)) continue;
+		int fd = -1;
+		for (int attempt = 0; attempt < 600 && fd < 0; ++attempt) {
+			fd = island_socket(islands->addresses[i], false, 0);
+			if (fd < 0) time_sleep_ms(100);
+		}
+		if (fd < 0) {
+			fprintf(stderr, "Couldn't connect to island %u (%s).\n", (uint)i, islands->addresses[i]);
+			return false;
+		}
+		FILE *fp = islands->out[i] = fdopen(fd, "wb");
+		if (!fp) return false;
+		fwrite_u32(fp, ISLAND_MAGIC);
+		fwrite_u32(fp, islands->index);
+		fflush(fp);
+	}
+
+	// accept connections from the islands we receive from
+	for (u32 i = 0; i < n; ++i) {
+		if (!island_receives_from(islands, i)) continue;
+		int fd = accept(islands->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			fprintf(stderr, "Couldn't accept connection: %s.\n", strerror(errno));
+			return false;
+		}
+		FILE *fp = fdopen(fd, "rb");
+		if (!fp) return false;
+		u32 magic = fread_u32(fp);
+		u32 from = fread_u32(fp);
+		if (ferror(fp) || feof(fp) || magic != ISLAND_MAGIC || from >= n
+			|| !island_receives_from(islands, from) || islands->in[from]) {
+			fprintf(stderr, "Bad connection to island %u.\n", (uint)islands->index);
+			fclose(fp);
+			return false;
+		}
+		islands->in[from] = fp;
+	}
+	return true;
+}
+
+static void islands_disconnect(Islands *islands) {
+	for (u32 i = 0; i < islands->nislands; ++i) {
+		if (islands->out[i]) fclose(islands->out[i]);
+		if (islands->in[i]) fclose(islands->in[i]);
+		islands->out[i] = islands->in[i] = NULL;
+	}
+	if (islands->listen_fd >= 0) {
+		close(islands->listen_fd);
+		if (strchr(islands->addresses[islands->index], '/'))
+			unlink(islands->addresses[islands->index]);
+	}
+	islands->listen_fd = -1;
+}
+
+// send our top setups to our neighbours, and replace our worst setups with theirs.
+// this should be called right after finish_generation.
+// if a neighbour disconnects, we just stop talking to it.
+static void islands_migrate(Islands *islands, State *state) {
+	u32 n = islands->nislands;
+	u64 generation = state->generation;
+	for (u32 i = 0; i < n; ++i) {
+		FILE *fp = islands->out[i];
+		if (!fp) continue;
+		fwrite_u32(fp, ISLAND_MAGIC);
+		fwrite_u64(fp, generation);
+		fwrite_u32(fp, state->top_kept);
+		for (u32 s = 0; s < state->top_kept; ++s) {
+			Setup const *setup = setup_top(state, s);
+			fwrite_float(fp, setup->score);
+			fwrite_float(fp, setup->total_time);
+			fwrite_u64(fp, setup->mutations);
+			setup_write(setup, fp);
+		}
+		if (fflush(fp) != 0 || ferror(fp)) {
+			fprintf(stderr, "Lost connection to island %u.\n", (uint)i);
+			fclose(fp);
+			islands->out[i] = NULL;
+		}
+	}
+
+	// immigrants replace the new setups (the top setups have already been selected), then the top setups are selected again
+	u32 nimmigrants = 0;
+	u32 max_immigrants = state->generation_size;
+	Setup *immigrants = &state->setups[state->top_kept];
+	for (u32 i = 0; i < n; ++i) {
+		FILE *fp = islands->in[i];
+		if (!fp) continue;
+		u32 magic = fread_u32(fp);
+		u64 their_generation = fread_u64(fp);
+		u32 count = fread_u32(fp);
+		// (count can be more than max_immigrants if the other island keeps more setups than we make; the rest are dropped)
+		bool ok = !ferror(fp) && !feof(fp) && magic == ISLAND_MAGIC
+			&& their_generation == generation;
+		for (u32 s = 0; ok && s < count; ++s) {
+			Setup setup = {};
+			setup.score = fread_float(fp);
+			setup.total_time = fread_float(fp);
+			setup.mutations = fread_u64(fp);
+			ok = setup_read(&setup, fp);
+			if (ok && nimmigrants < max_immigrants) {
+				// (we don't know what happened when it was simulated)
+				if (state->records) setup_record_clear(&state->records[state->top_kept + nimmigrants]);
+				immigrants[nimmigrants++] = setup;
+			}
+		}
+		if (!ok) {
+			fprintf(stderr, "Lost connection to island %u.\n", (uint)i);
+			fclose(fp);
+			islands->in[i] = NULL;
+		}
+	}
+	setups_select_top(state);
+}
+#endif // __unix__
@@ -0,0 +1,14 @@
+#!/bin/sh
+# run several islands on this machine, talking over Unix domain sockets.
+# usage: ./islands.sh <number of islands> [other options for boxcatapult2d-headless]
+n=${1:-4}
+[ $# -gt 0 ] && shift
+mkdir -p islands
+peers=""
+for i in $(seq 0 $((n-1))); do
+	peers="$peers${peers:+,}islands/$i.sock"
+done
+for i in $(seq 0 $((n-1))); do
+	./boxcatapult2d-headless -island $i -peers $peers -o islands/$i "$@" > islands/$i.log &
+done
+wait
@@ -6,6 +6,7 @@ if _%VCVARS% == _ (
 if not exist obj mkdir obj
 
 SET CFLAGS=/nologo /W4 /wd4505 /wd4706 /D_CRT_SECURE_NO_WARNINGS /I SDL2/include /I box2d SDL2/lib/x64/SDL2main.lib SDL2/lib/x64/SDL2.lib opengl32.lib box2d.lib /MD
+SET HEADLESS_CFLAGS=/nologo /W4 /wd4505 /wd4706 /D_CRT_SECURE_NO_WARNINGS /I box2d box2d.lib /MD
 rc /nologo boxcatapult2d.rc
 if _%1 == _ (
 	cl main.cpp /DDEBUG /DEBUG /Zi %CFLAGS% /Fo:obj/urbs /Fe:boxcatapult2d boxcatapult2d.res
@@ -13,3 +14,4 @@ if _%1 == _ (
 	rem echo > obj\sim.dll_changed
 )
 if _%1 == _release cl main.cpp /O2 %CFLAGS% /Fe:boxcatapult2d boxcatapult2d.res
+if _%1 == _headless cl headless.cpp /O2 %HEADLESS_CFLAGS% /Fo:obj/headless /Fe:boxcatapult2d-headless
@@ -78,27 +78,59 @@ static float smoothstepf(float x) {
 	return x * x * (3 - 2 * x);
 }
 
-static float randf(void) {
-	return (float)rand() / (float)((ulong)RAND_MAX + 1);
+// PCG32 random number generator (see https://www.pcg-random.org)
+typedef struct {
+	u64 state;
+	u64 inc; // which stream this generator is on (must be odd)
+} Rng;
+
+static u32 rand_u32(Rng *rng) {
+	u64 old = rng->state;
+	rng->state = old * 6364136223846793005ULL + rng->inc;
+	u32 xorshifted = (u32)(((old >> 18) ^ old) >> 27);
+	u32 rot = (u32)(old >> 59);
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+static void rng_seed(Rng *rng, u64 seed, u64 stream) {
+	rng->state = 0;
+	rng->inc = (stream << 1) | 1;
+	rand_u32(rng);
+	rng->state += seed;
+	rand_u32(rng);
+}
+
+// a good way of mixing up the bits of x (the SplitMix64 finalizer)
+static u64 hash_u64(u64 x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// get an independent generator for (seed, a, b), e.g. (run seed, generation, index)
+static Rng rng_derive(u64 seed, u64 a, u64 b) {
+	Rng rng;
+	rng_seed(&rng, hash_u64(hash_u64(seed) ^ a), b);
+	return rng;
+}
+
+// uniformly distributed in [0, 1)
+static float randf(Rng *rng) {
+	return (float)(rand_u32(rng) >> 8) * (1.0f / 16777216.0f);
 }
 
-static float rand_gauss(void) {
+static float rand_gauss(Rng *rng) {
 	// https://en.wikipedia.org/wiki/Normal_distribution#Generating_values_from_normal_distribution
 	float U, V;
 	do {
-		U = randf(), V = randf();
+		U = randf(rng), V = randf(rng);
 	} while (U == 0 || V == 0);
 	return sqrtf(-2 * logf(U)) * cosf(TAUf * V);
 }
 
-static u32 rand_u32(void) {
-	return ((u32)rand() & 0xfff)
-		| ((u32)rand() & 0xfff) << 12
-		| ((u32)rand() & 0xff) << 24;
-}
-
-static float rand_uniform(float from, float to) {
-	return lerpf(randf(), from, to);
+static float rand_uniform(Rng *rng, float from, float to) {
+	return lerpf(randf(rng), from, to);
 }
 
 static float sigmoidf(float x) {
@@ -179,6 +211,10 @@ static v2 v2_normalize(v2 v) {
 	return v2_scale(v, mul);
 }
 
+static bool v2_eq(v2 a, v2 b) {
+	return a.x == b.x && a.y == b.y;
+}
+
 static float v2_dist(v2 a, v2 b) {
 	return v2_len(v2_sub(a, b));
 }
@@ -198,18 +234,18 @@ static void v2_gl_vertex(v2 v) {
 }
 #endif
 
-static v2 v2_rand_unit(void) {
-	float theta = rand_uniform(0, TAUf);
+static v2 v2_rand_unit(Rng *rng) {
+	float theta = rand_uniform(rng, 0, TAUf);
 	return V2(cosf(theta), sinf(theta));
 }
 
 #if MATH_GL
-static void v2_rand_unit_test(void) {
+static void v2_rand_unit_test(Rng *rng) {
 	int i;
 	glColor3f(1.0f, 0.0f, 0.0f);
 	glBegin(GL_POINTS);
 	for (i = 0; i < 100000; ++i) {
-		v2_gl_vertex(v2_rand_unit());
+		v2_gl_vertex(v2_rand_unit(rng));
 	}
 	glEnd();
 }
@@ -308,11 +344,11 @@ static void v3_print(v3 v) {
 	printf("(%f, %f, %f)\n", v.x, v.y, v.z);
 }
 
-static v3 v3_rand(void) {
-	return V3(randf(), randf(), randf());
+static v3 v3_rand(Rng *rng) {
+	return V3(randf(rng), randf(rng), randf(rng));
 }
 
-static v3 v3_rand_unit(void) {
+static v3 v3_rand_unit(Rng *rng) {
 	/*
 		monte carlo method
 		keep generating random points in cube of radius 1 (width 2) centered at origin,
@@ -320,7 +356,7 @@ static v3 v3_rand_unit(void) {
 		on the sphere.
 	*/
 	while (1) {
-		v3 v = V3(rand_uniform(-1.0f, +1.0f), rand_uniform(-1.0f, +1.0f), rand_uniform(-1.0f, +1.0f));
+		v3 v = V3(rand_uniform(rng, -1.0f, +1.0f), rand_uniform(rng, -1.0f, +1.0f), rand_uniform(rng, -1.0f, +1.0f));
 		float dist_squared_to_origin = v3_dot(v, v);
 		if (dist_squared_to_origin <= 1 && dist_squared_to_origin != 0.0f) {
 			return v3_scale(v, 1.0f / sqrtf(dist_squared_to_origin));
@@ -330,12 +366,12 @@ static v3 v3_rand_unit(void) {
 }
 
 #if MATH_GL
-static void v3_rand_unit_test(void) {
+static void v3_rand_unit_test(Rng *rng) {
 	int i;
 	glColor3f(1.0f, 0.0f, 0.0f);
 	glBegin(GL_POINTS);
 	for (i = 0; i < 100000; ++i) {
-		v3_gl_vertex(v3_rand_unit());
+		v3_gl_vertex(v3_rand_unit(rng));
 	}
 	glEnd();
 }
@@ -405,8 +441,8 @@ static v3 v4_xyz(v4 v) {
 	return V3(v.x, v.y, v.z);
 }
 
-static v4 v4_rand(void) {
-	return V4(randf(), randf(), randf(), randf());
+static v4 v4_rand(Rng *rng) {
+	return V4(randf(rng), randf(rng), randf(rng), randf(rng));
 }
 
 static void v4_print(v4 v) {
@@ -703,6 +739,7 @@ static void gl_quad(float x1, float y1, float x2, float y2) {
 	glVertex2f(x2, y2);
 	glVertex2f(x1, y2);
 }
+#endif
 
 // returns average of red green and blue components of color
 static float rgba_brightness(u32 color) {
@@ -710,6 +747,12 @@ static float rgba_brightness(u32 color) {
 	return ((float)r+(float)g+(float)b) * (1.0f / 3);
 }
 
+// smallest rectangle containing both r1 and r2
+static Rect rect_union(Rect r1, Rect r2) {
+	return rect4(minf(rect_x1(r1), rect_x1(r2)), minf(rect_y1(r1), rect_y1(r2)),
+		maxf(rect_x2(r1), rect_x2(r2)), maxf(rect_y2(r1), rect_y2(r2)));
+}
+
 static float rects_intersect(Rect r1, Rect r2) {
 	if (r1.pos.x >= r2.pos.x + r2.size.x) return false; // r1 is to the right of r2
 	if (r2.pos.x >= r1.pos.x + r1.size.x) return false; // r2 is to the right of r1
@@ -717,5 +760,4 @@ static float rects_intersect(Rect r1, Rect r2) {
 	if (r2.pos.y >= r1.pos.y + r1.size.y) return false; // r2 is above r1
 	return true;
 }
-#endif
 
@@ -0,0 +1,250 @@
+/*
+Novelty search (State.novelty): setups are ranked by score + novelty_weight * novelty, where novelty is how
+different what the setup does with the ball is from what setups have done before. This stops the whole
+population from turning into copies of one catapult.
+What a setup does is its behaviour: (where the ball lands, how long it takes), with 1 second counting as
+much as 1 meter. Its novelty is the mean distance from its behaviour to the NOVELTY_K nearest ones in the archive.
+New setups which are novel enough (more than add_threshold) are added to the archive, and add_threshold is
+adjusted so that about NOVELTY_ADD_TARGET of each generation's new setups are added.
+
+The archive is a uniform grid of NOVELTY_CELL_SIZE x NOVELTY_CELL_SIZE cells, kept in a hash table
+(behaviours can be anywhere), with a linked list of behaviours in each cell. To find the nearest ones,
+we look at rings of cells around the query's cell, and stop once there are NOVELTY_K behaviours closer
+than anything outside the rings could be. So queries only look at the behaviours near the query,
+however big the archive gets.
+*/
+
+#define NOVELTY_K 15
+#define NOVELTY_CELL_SIZE 0.5f
+#define NOVELTY_TIME_SCALE 1.0f // meters a second of total_time counts as
+#define NOVELTY_ADD_TARGET 0.05f // fraction of new setups we want to add to the archive
+#define NOVELTY_NONE U32_MAX
+
+static v2 setup_behaviour(Setup const *setup) {
+	return V2(setup->score, setup->total_time * NOVELTY_TIME_SCALE);
+}
+
+static i32 novelty_cell_coord(float x) {
+	float c = floorf(x / NOVELTY_CELL_SIZE);
+	// (keep far away behaviours from overflowing)
+	if (c < -1e9f) c = -1e9f;
+	if (c > 1e9f) c = 1e9f;
+	return (i32)c;
+}
+
+static u32 novelty_cell_hash(i32 x, i32 y) {
+	return (u32)hash_u64((u64)(u32)x | (u64)(u32)y << 32);
+}
+
+// returns the cell (x, y), or an empty cell where it should go
+static NoveltyCell *novelty_cell_find(NoveltyArchive *archive, i32 x, i32 y) {
+	u32 mask = archive->cells_cap - 1;
+	for (u32 i = novelty_cell_hash(x, y) & mask; ; i = (i + 1) & mask) {
+		NoveltyCell *cell = &archive->cells[i];
+		if (cell->head == NOVELTY_NONE || (cell->x == x && cell->y == y))
+			return cell;
+	}
+}
+
+static void novelty_archive_free(NoveltyArchive *archive) {
+	free(archive->behaviours);
+	free(archive->next);
+	free(archive->cells);
+	memset(archive, 0, sizeof *archive);
+}
+
+static bool novelty_cells_resize(NoveltyArchive *archive, u32 cells_cap) {
+	NoveltyCell *old_cells = archive->cells;
+	u32 old_cap = archive->cells_cap;
+	archive->cells = calloc_arr(NoveltyCell, cells_cap);
+	if (!archive->cells) {
+		archive->cells = old_cells;
+		return false;
+	}
+	archive->cells_cap = cells_cap;
+	for (u32 i = 0; i < cells_cap; ++i)
+		archive->cells[i].head = NOVELTY_NONE;
+	for (u32 i = 0; i < old_cap; ++i) {
+		NoveltyCell const *old = &old_cells[i];
+		if (old->head != NOVELTY_NONE)
+			*novelty_cell_find(archive, old->x, old->y) = *old;
+	}
+	free(old_cells);
+	return true;
+}
+
+static bool novelty_archive_add(NoveltyArchive *archive, v2 behaviour) {
+	if (archive->n == archive->cap) {
+		u32 cap = archive->cap ? archive->cap * 2 : 1024;
+		v2 *behaviours = (v2 *)realloc(archive->behaviours, cap * sizeof *behaviours);
+		if (behaviours) archive->behaviours = behaviours;
+		u32 *next = (u32 *)realloc(archive->next, cap * sizeof *next);
+		if (next) archive->next = next;
+		if (!behaviours || !next) return false;
+		archive->cap = cap;
+	}
+	if ((archive->ncells + 1) * 2 > archive->cells_cap) {
+		if (!novelty_cells_resize(archive, archive->cells_cap ? archive->cells_cap * 2 : 1024))
+			return false;
+	}
+	i32 x = novelty_cell_coord(behaviour.x), y = novelty_cell_coord(behaviour.y);
+	NoveltyCell *cell = novelty_cell_find(archive, x, y);
+	if (cell->head == NOVELTY_NONE) {
+		cell->x = x;
+		cell->y = y;
+		++archive->ncells;
+		if (archive->n == 0) {
+			archive->min_x = archive->max_x = x;
+			archive->min_y = archive->max_y = y;
+		}
+		if (x < archive->min_x) archive->min_x = x;
+		if (x > archive->max_x) archive->max_x = x;
+		if (y < archive->min_y) archive->min_y = y;
+		if (y > archive->max_y) archive->max_y = y;
+	}
+	u32 i = archive->n++;
+	archive->behaviours[i] = behaviour;
+	archive->next[i] = cell->head;
+	cell->head = i;
+	return true;
+}
+
+// squared distances to the nearest neighbours found so far, in increasing order
+typedef struct {
+	u32 n;
+	float dist_squared[NOVELTY_K];
+} NoveltyNeighbours;
+
+static void novelty_neighbours_add(NoveltyNeighbours *neighbours, float dist_squared) {
+	u32 n = neighbours->n;
+	if (n == NOVELTY_K) {
+		if (dist_squared >= neighbours->dist_squared[n-1]) return;
+		--n;
+	}
+	while (n > 0 && neighbours->dist_squared[n-1] > dist_squared) {
+		neighbours->dist_squared[n] = neighbours->dist_squared[n-1];
+		--n;
+	}
+	neighbours->dist_squared[n] = dist_squared;
+	if (neighbours->n < NOVELTY_K) ++neighbours->n;
+}
+
+static void novelty_cell_search(NoveltyArchive *archive, i32 x, i32 y, v2 behaviour, NoveltyNeighbours *neighbours) {
+	NoveltyCell const *cell = novelty_cell_find(archive, x, y);
+	for (u32 i = cell->head; i != NOVELTY_NONE; i = archive->next[i])
+		novelty_neighbours_add(neighbours, v2_dist_squared(archive->behaviours[i], behaviour));
+}
+
+// mean distance from behaviour to its NOVELTY_K nearest neighbours in the archive (or all of them, if there are fewer)
+static float novelty_of(NoveltyArchive *archive, v2 behaviour) {
+	if (!archive->n) return 0;
+	NoveltyNeighbours neighbours = {};
+	i32 cx = novelty_cell_coord(behaviour.x), cy = novelty_cell_coord(behaviour.y);
+	for (i32 r = 0; ; ++r) {
+		// search the ring of cells r away from (cx, cy)
+		for (i32 x = cx - r; x <= cx + r; ++x) {
+			if (x < archive->min_x || x > archive->max_x) continue;
+			bool edge = x == cx - r || x == cx + r;
+			for (i32 y = cy - r; y <= cy + r; y += edge ? 1 : 2 * r) {
+				if (y >= archive->min_y && y <= archive->max_y)
+					novelty_cell_search(archive, x, y, behaviour, &neighbours);
+				if (r == 0) break;
+			}
+		}
+		// anything outside the rings searched so far is at least r cells away
+		float reach = (float)r * NOVELTY_CELL_SIZE;
+		if (neighbours.n == NOVELTY_K && neighbours.dist_squared[NOVELTY_K-1] <= reach * reach)
+			break;
+		if (cx - r <= archive->min_x && cx + r >= archive->max_x && cy - r <= archive->min_y && cy + r >= archive->max_y)
+			break; // we've searched every cell
+	}
+	float total = 0;
+	for (u32 i = 0; i < neighbours.n; ++i)
+		total += sqrtf(neighbours.dist_squared[i]);
+	return total / (float)neighbours.n;
+}
+
+// work out the novelty of all the setups, then add the new ones which are novel enough to the archive.
+// this should be called before setups_select_top.
+// first_new is the index of the first setup which hasn't been considered for the archive yet.
+static void novelty_update(State *state, u32 first_new) {
+	NoveltyArchive *archive = &state->novelty_archive;
+	if (archive->n == 0) {
+		// nothing to compare the first setups with, so they all go in
+		archive->add_threshold = NOVELTY_CELL_SIZE;
+		u32 nadded = 0;
+		for (u32 i = first_new; i < state->nsetups; ++i)
+			nadded += novelty_archive_add(archive, setup_behaviour(&state->setups[i]));
+		for (u32 i = 0; i < state->nsetups; ++i) {
+			Setup *setup = &state->setups[i];
+			setup->novelty = novelty_of(archive, setup_behaviour(setup));
+		}
+		archive->nadded = nadded;
+		return;
+	}
+	for (u32 i = 0; i < state->nsetups; ++i) {
+		Setup *setup = &state->setups[i];
+		setup->novelty = novelty_of(archive, setup_behaviour(setup));
+	}
+	u32 nadded = 0;
+	for (u32 i = first_new; i < state->nsetups; ++i) {
+		Setup const *setup = &state->setups[i];
+		if (setup->novelty > archive->add_threshold)
+			nadded += novelty_archive_add(archive, setup_behaviour(setup));
+	}
+	archive->nadded = nadded;
+	// aim for NOVELTY_ADD_TARGET of the new setups being added
+	u32 nnew = state->nsetups - first_new;
+	if ((float)nadded > NOVELTY_ADD_TARGET * (float)nnew) archive->add_threshold *= 1.1f;
+	else archive->add_threshold *= 0.95f;
+}
+
+// find the nearest neighbours of nqueries random behaviours among n random behaviours,
+// with the grid and by checking every behaviour, and print how long it took
+static void novelty_bench(u32 n, u32 nqueries) {
+	NoveltyArchive archive = {};
+	Rng rng = rng_derive(0, 1, 2);
+	// (something like real behaviours: mostly under 30m and 20s, with a lot of them close together)
+	for (u32 i = 0; i < n; ++i) {
+		float spread = randf(&rng) < 0.5f ? 1.0f : 10.0f;
+		v2 centre = V2(15.0f, 8.0f);
+		v2 behaviour = V2(centre.x + spread * (randf(&rng) - 0.5f) * 3, centre.y + spread * (randf(&rng) - 0.5f) * 2);
+		if (!novelty_archive_add(&archive, behaviour)) {
+			printf("Out of memory.\n");
+			novelty_archive_free(&archive);
+			return;
+		}
+	}
+	v2 *queries = calloc_arr(v2, nqueries);
+	float *grid = calloc_arr(float, nqueries);
+	if (!queries || !grid) {
+		free(queries); free(grid);
+		novelty_archive_free(&archive);
+		return;
+	}
+	for (u32 q = 0; q < nqueries; ++q)
+		queries[q] = V2(rand_uniform(&rng, -5, 45), rand_uniform(&rng, -5, 25));
+
+	struct timespec start = time_get();
+	for (u32 q = 0; q < nqueries; ++q)
+		grid[q] = novelty_of(&archive, queries[q]);
+	double time_grid = timespec_sub(time_get(), start);
+
+	start = time_get();
+	u32 nwrong = 0;
+	for (u32 q = 0; q < nqueries; ++q) {
+		NoveltyNeighbours neighbours = {};
+		for (u32 i = 0; i < archive.n; ++i)
+			novelty_neighbours_add(&neighbours, v2_dist_squared(archive.behaviours[i], queries[q]));
+		float total = 0;
+		for (u32 i = 0; i < neighbours.n; ++i)
+			total += sqrtf(neighbours.dist_squared[i]);
+		float novelty = total / (float)neighbours.n;
+		nwrong += fabsf(novelty - grid[q]) > 1e-4f * (1 + novelty);
+	}
+	double time_all = timespec_sub(time_get(), start);
+	printf("%u behaviours in %u cells, %u queries: grid %.3fs (%.2fus per query), checking every behaviour %.3fs; %u different results\n",
+		(uint)archive.n, (uint)archive.ncells, (uint)nqueries, time_grid, 1e6 * time_grid / nqueries, time_all, (uint)nwrong);
+	free(queries); free(grid);
+	novelty_archive_free(&archive);
+}
@@ -0,0 +1,217 @@
+/*
+Multi-objective mode (State.pareto): instead of just throwing the ball as far as possible, setups try to
+throw it far (score), quickly (total_time) and cheaply (platforms_cost), and the top setups are chosen like NSGA-II:
+the setups are split into fronts (the first front is the setups which no other setup beats in every objective,
+the second front is the ones which only the first front beats, etc.), whole fronts are kept best first,
+and the front which doesn't all fit is thinned out by keeping its most spread out setups (crowding distance).
+
+Finding a front uses the fact that there are only three objectives: after sorting the setups by the first one,
+a setup is in the front if no setup before it is at least as good in the other two, which is checked
+with a "staircase" of the best (second, third) objective values seen so far, in O(log n).
+So each front takes O(n log n), and we stop as soon as we have enough setups.
+
+The Pareto archive is the first front of every setup seen so far (thinned out the same way if it gets too big).
+*/
+
+#define PARETO_ARCHIVE_SIZE 64
+#define PARETO_NOT_CHOSEN U32_MAX
+
+typedef struct {
+	float f[3]; // objectives, all to be minimized: -score, total_time, cost
+	u32 position; // for breaking ties
+	u32 id; // index into whatever the caller is choosing from
+	u32 front; // front this point was chosen in, or PARETO_NOT_CHOSEN
+	float crowding;
+} ParetoPoint;
+
+static void pareto_point_set(ParetoPoint *point, Setup const *setup, u32 position, u32 id) {
+	point->f[0] = -setup->score;
+	point->f[1] = setup->total_time;
+	point->f[2] = platforms_cost(setup->platforms, setup->nplatforms);
+	point->position = position;
+	point->id = id;
+	point->front = PARETO_NOT_CHOSEN;
+	point->crowding = 0;
+}
+
+static int pareto_compare_objectives(void const *a_void, void const *b_void) {
+	ParetoPoint const *a = (ParetoPoint const *)a_void, *b = (ParetoPoint const *)b_void;
+	for (int m = 0; m < 3; ++m)
+		if (a->f[m] != b->f[m]) return a->f[m] < b->f[m] ? -1 : +1;
+	return a->position < b->position ? -1 : a->position > b->position;
+}
+
+// chosen points first, by front, then by score (then by the other objectives, so that identical points are together)
+static int pareto_compare_chosen(void const *a_void, void const *b_void) {
+	ParetoPoint const *a = (ParetoPoint const *)a_void, *b = (ParetoPoint const *)b_void;
+	if (a->front != b->front) return a->front < b->front ? -1 : +1;
+	return pareto_compare_objectives(a, b);
+}
+
+static int pareto_compare_crowding(void const *a_void, void const *b_void) {
+	ParetoPoint const *a = *(ParetoPoint const *const *)a_void, *b = *(ParetoPoint const *const *)b_void;
+	if (a->crowding != b->crowding) return a->crowding > b->crowding ? -1 : +1;
+	return a->position < b->position ? -1 : a->position > b->position;
+}
+
+static int pareto_objective_being_sorted; // (qsort doesn't let us pass this in)
+static int pareto_compare_objective(void const *a_void, void const *b_void) {
+	ParetoPoint const *a = *(ParetoPoint const *const *)a_void, *b = *(ParetoPoint const *const *)b_void;
+	int m = pareto_objective_being_sorted;
+	if (a->f[m] != b->f[m]) return a->f[m] < b->f[m] ? -1 : +1;
+	return a->position < b->position ? -1 : a->position > b->position;
+}
+
+// set the crowding distance of each of members[0..n)
+static void pareto_crowding(ParetoPoint **members, u32 n) {
+	for (u32 i = 0; i < n; ++i) members[i]->crowding = 0;
+	for (int m = 0; m < 3; ++m) {
+		pareto_objective_being_sorted = m;
+		qsort(members, n, sizeof *members, pareto_compare_objective);
+		float range = members[n-1]->f[m] - members[0]->f[m];
+		members[0]->crowding = members[n-1]->crowding = INFINITY;
+		if (range <= 0) continue;
+		for (u32 i = 1; i + 1 < n; ++i)
+			members[i]->crowding += (members[i+1]->f[m] - members[i-1]->f[m]) / range;
+	}
+}
+
+// choose up to k of points[0..n), from at most max_fronts fronts.
+// afterwards, the chosen points are points[0..returned value), by front and then by score (see pareto_compare_chosen).
+// returns 0 if there isn't enough memory.
+static u32 pareto_choose(ParetoPoint *points, u32 n, u32 k, u32 max_fronts) {
+	// the staircase: (f[1], f[2]) of the points in this front so far, with stair_x increasing and stair_y decreasing
+	float *stair_x = calloc_arr(float, n);
+	float *stair_y = calloc_arr(float, n);
+	ParetoPoint **members = calloc_arr(ParetoPoint *, n);
+	if (!stair_x || !stair_y || !members) {
+		free(stair_x); free(stair_y); free(members);
+		return 0;
+	}
+	qsort(points, n, sizeof *points, pareto_compare_objectives);
+	u32 nchosen = 0, nleft = n;
+	for (u32 front = 0; front < max_fronts && nchosen < k && nleft > 0; ++front) {
+		u32 nstairs = 0, nmembers = 0;
+		for (u32 i = 0; i < n; ) {
+			if (points[i].front != PARETO_NOT_CHOSEN) {
+				++i;
+				continue;
+			}
+			float x = points[i].f[1], y = points[i].f[2];
+			// find the first stair with stair_x > x
+			u32 lo = 0, hi = nstairs;
+			while (lo < hi) {
+				u32 mid = (lo + hi) / 2;
+				if (stair_x[mid] <= x) lo = mid + 1;
+				else hi = mid;
+			}
+			// the stair before that has the lowest stair_y of all the points with stair_x <= x
+			bool dominated = lo > 0 && stair_y[lo-1] <= y;
+			// points with exactly the same objectives don't dominate each other, so they're all in the front or none are
+			u32 same = i + 1;
+			while (same < n && points[same].f[0] == points[i].f[0] && points[same].f[1] == x && points[same].f[2] == y)
+				++same;
+			if (!dominated) {
+				for (u32 j = i; j < same; ++j)
+					if (points[j].front == PARETO_NOT_CHOSEN)
+						members[nmembers++] = &points[j];
+				// remove the stairs the new one is at least as good as, then put it in
+				u32 start = lo;
+				while (start > 0 && stair_x[start-1] == x) --start; // (these all have stair_y > y)
+				u32 end = start;
+				while (end < nstairs && stair_y[end] >= y) ++end;
+				memmove(&stair_x[start+1], &stair_x[end], (nstairs - end) * sizeof *stair_x);
+				memmove(&stair_y[start+1], &stair_y[end], (nstairs - end) * sizeof *stair_y);
+				nstairs = nstairs + 1 - (end - start);
+				stair_x[start] = x;
+				stair_y[start] = y;
+			}
+			i = same;
+		}
+		if (nchosen + nmembers > k) {
+			// the whole front doesn't fit; keep the most spread out part of it
+			pareto_crowding(members, nmembers);
+			qsort(members, nmembers, sizeof *members, pareto_compare_crowding);
+			nmembers = k - nchosen;
+		}
+		for (u32 m = 0; m < nmembers; ++m)
+			members[m]->front = front;
+		nchosen += nmembers;
+		nleft -= nmembers;
+	}
+	qsort(points, n, sizeof *points, pareto_compare_chosen);
+	free(stair_x); free(stair_y); free(members);
+	return nchosen;
+}
+
+// like setup_keys_select followed by sorting the top k keys, but for State.pareto.
+// returns false if there isn't enough memory.
+static bool pareto_select(State *state, SetupKey *keys, u32 n, u32 k) {
+	ParetoPoint *points = calloc_arr(ParetoPoint, n);
+	SetupKey *old_keys = calloc_arr(SetupKey, n);
+	bool success = points && old_keys;
+	if (success) {
+		memcpy(old_keys, keys, n * sizeof *keys);
+		for (u32 i = 0; i < n; ++i)
+			pareto_point_set(&points[i], &state->setups[keys[i].index], keys[i].position, i);
+		success = pareto_choose(points, n, k, U32_MAX) == k;
+	}
+	if (success) {
+		state->pareto_front_size = 0;
+		for (u32 i = 0; i < n; ++i) {
+			keys[i] = old_keys[points[i].id];
+			state->pareto_front_size += points[i].front == 0;
+		}
+	}
+	free(points); free(old_keys);
+	return success;
+}
+
+// add the setups in the first front of the population to the archive (and throw away the ones that are now beaten)
+static void pareto_archive_update(State *state) {
+	u32 narchive = state->npareto_archive;
+	u32 n = narchive + state->nsetups;
+	ParetoPoint *points = calloc_arr(ParetoPoint, n);
+	Setup *archive = calloc_arr(Setup, PARETO_ARCHIVE_SIZE);
+	if (!points || !archive) {
+		free(points); free(archive);
+		return;
+	}
+	// (the archive goes first, so that it wins ties with identical setups in the population)
+	for (u32 i = 0; i < narchive; ++i)
+		pareto_point_set(&points[i], &state->pareto_archive[i], i, i);
+	for (u32 i = 0; i < state->nsetups; ++i)
+		pareto_point_set(&points[narchive + i], &state->setups[i], narchive + i, narchive + i);
+	u32 nchosen = pareto_choose(points, n, PARETO_ARCHIVE_SIZE, 1);
+	u32 nkept = 0;
+	for (u32 c = 0; c < nchosen; ++c) {
+		// don't keep more than one setup with the same objectives
+		if (c > 0 && memcmp(points[c].f, points[c-1].f, sizeof points[c].f) == 0) continue;
+		u32 id = points[c].id;
+		Setup const *setup = id < narchive ? &state->pareto_archive[id] : &state->setups[id - narchive];
+		archive[nkept++] = *setup;
+	}
+	free(state->pareto_archive);
+	state->pareto_archive = archive;
+	state->npareto_archive = nkept;
+	free(points);
+}
+
+// write the archive to <output_dir>/pareto_<i>.b2s, and a list of their objectives to <output_dir>/pareto.txt
+static bool pareto_archive_write(State const *state) {
+	char filename[512] = {0};
+	snprintf(filename, sizeof filename - 1, "%s/pareto.txt", state->output_dir);
+	FILE *fp = fopen(filename, "w");
+	if (!fp) return false;
+	fprintf(fp, "file\tdistance\ttime\tcost\n");
+	for (u32 i = 0; i < state->npareto_archive; ++i) {
+		Setup const *setup = &state->pareto_archive[i];
+		snprintf(filename, sizeof filename - 1, "%s/pareto_%03u.b2s", state->output_dir, (uint)i);
+		setup_write_to_file(setup, filename);
+		fprintf(fp, "pareto_%03u.b2s\t%.2f\t%.2f\t%.2f\n", (uint)i, setup->score, setup->total_time,
+			platforms_cost(setup->platforms, setup->nplatforms));
+	}
+	bool success = !ferror(fp);
+	fclose(fp);
+	return success;
+}
@@ -69,6 +69,48 @@ static float platform_rightmost_x(Platform const *platform) {
 	return platform_highest_coordinate(platform, false);
 }
 
+// has this moving platform gone past one of its endpoints (going at velocity vel)?
+static bool platform_turns_around(Platform const *platform, v2 pos, v2 vel) {
+	v2 p1 = platform->move_p1, p2 = platform->move_p2;
+	bool switch_direction = false;
+
+	if (vel.x > 0) {
+		if (pos.x > maxf(p1.x, p2.x))
+			switch_direction = true;
+	} else if (vel.x < 0) {
+		if (pos.x < minf(p1.x, p2.x))
+			switch_direction = true;
+	}
+	if (vel.y > 0) {
+		if (pos.y > maxf(p1.y, p2.y))
+			switch_direction = true;
+	} else if (vel.y < 0) {
+		if (pos.y < minf(p1.y, p2.y))
+			switch_direction = true;
+	}
+	return switch_direction;
+}
+
+// where a platform's body is after nsteps time steps, if nothing else is in the world.
+// this moves it the same way Box2D moves kinematic bodies.
+static BodyCheckpoint platform_replay(Platform const *platform, u32 nsteps, float time_step) {
+	BodyCheckpoint body;
+	body.pos = platform->moves ? platform->move_p1 : platform->center;
+	body.angle = platform->start_angle;
+	body.velocity = V2(0, 0);
+	if (platform->moves)
+		body.velocity = v2_scale(v2_normalize(v2_sub(platform->move_p2, platform->move_p1)), platform->move_speed);
+	body.angular_velocity = platform->rotate_speed;
+	for (u32 i = 0; i < nsteps; ++i) {
+		body.pos.x += time_step * body.velocity.x;
+		body.pos.y += time_step * body.velocity.y;
+		body.angle += time_step * body.angular_velocity;
+		if (platform->moves && platform_turns_around(platform, body.pos, body.velocity))
+			body.velocity = v2_scale(body.velocity, -1);
+	}
+	return body;
+}
+
 // where the ball's distance traveled should be measured from
 static float platforms_starting_line(Platform const *platforms, u32 nplatforms) {
 	float rightmost_x = BALL_STARTING_X; // the starting line can't be to the left of the ball
@@ -80,11 +122,12 @@ static float platforms_starting_line(Platform const *platforms, u32 nplatforms)
 	return rightmost_x;
 }
 
+#if !HEADLESS
 // render the given platforms
 static void platforms_render(State *state, Platform *platforms, u32 nplatforms) {
 	GL *gl = &state->gl;
 	ShaderPlatform *shader = &state->shader_platform;
-	float platform_render_thickness = state->platform_thickness;
+	float platform_render_thickness = state->sim.platform_thickness;
 
 	shader_start_using(gl, &shader->base);
 	
@@ -187,10 +230,11 @@ static void platforms_render(State *state, Platform *platforms, u32 nplatforms)
 		glEnd();
 	}
 }
+#endif
 
-// sets platform->body to a new Box2D body.
-static void platform_make_body(State *state, Platform *platform, u32 index) {
-	b2World *world = state->world;
+// sets platform->body to a new Box2D body (or a pooled one).
+static void platform_make_body(SimContext *sim, Platform *platform, u32 index) {
+	b2World *world = sim->world;
 	assert(!platform->body);
 
 	float radius = platform->radius;
@@ -200,6 +244,22 @@ static void platform_make_body(State *state, Platform *platform, u32 index) {
 
 	v2 center = platform->center;
 
+	if (sim->nplatform_body_pool) {
+		// reconfigure a pooled body. the shape and transform need to be set before the body is enabled,
+		// so that its broad-phase proxy is created in the right place.
+		b2Body *body = sim->platform_body_pool[--sim->nplatform_body_pool];
+		b2Fixture *fixture = body->GetFixtureList();
+		((b2PolygonShape *)fixture->GetShape())->SetAsBox(radius, sim->platform_thickness);
+		fixture->GetUserData().pointer = USER_DATA_PLATFORM | index;
+		body->SetTransform(v2_to_b2(center), platform->angle);
+		body->SetLinearVelocity(b2Vec2(0, 0));
+		body->SetAngularVelocity(0);
+		body->SetEnabled(true);
+		body->SetAwake(true);
+		platform->body = body;
+		return;
+	}
+
 	b2BodyDef body_def;
 	body_def.type = b2_kinematicBody;
 	body_def.position.Set(center.x, center.y);
@@ -207,11 +267,11 @@ static void platform_make_body(State *state, Platform *platform, u32 index) {
 	b2Body *body = world->CreateBody(&body_def);
 
 	b2PolygonShape shape;
-	shape.SetAsBox(radius, state->platform_thickness);
+	shape.SetAsBox(radius, sim->platform_thickness);
 
 	b2FixtureDef fixture;
 	fixture.shape = &shape;
-	fixture.friction = 0.5f;
+	fixture.friction = PLATFORM_FRICTION;
 	fixture.userData.pointer = USER_DATA_PLATFORM | index;
 
 	body->CreateFixture(&fixture);
@@ -221,6 +281,19 @@ static void platform_make_body(State *state, Platform *platform, u32 index) {
 	platform->body = body;
 }
 
+// get rid of platform->body (or put it in the pool)
+static void platform_remove_body(SimContext *sim, Platform *platform) {
+	b2Body *body = platform->body;
+	if (!body) return;
+	if (sim->pool_bodies && sim->nplatform_body_pool < MAX_PLATFORMS) {
+		body->SetEnabled(false);
+		sim->platform_body_pool[sim->nplatform_body_pool++] = body;
+	} else {
+		sim->world->DestroyBody(body);
+	}
+	platform->body = NULL;
+}
+
 class PlatformQueryCallback : public b2QueryCallback {
 public:
 	PlatformQueryCallback(State *state_) {
@@ -230,8 +303,8 @@ public:
 		uintptr_t userdata = fixture->GetUserData().pointer;
 		if (userdata & USER_DATA_PLATFORM) {
 			u32 index = (u32)(userdata & ~USER_DATA_PLATFORM);
-			assert(index < state->nplatforms);
-			platform = &state->platforms[index];
+			assert(index < state->sim.nplatforms);
+			platform = &state->sim.platforms[index];
 			return false; // we can stop now
 		} else {
 			return true; // keep going
@@ -250,16 +323,16 @@ static Platform *platform_at_mouse_pos(State *state) {
 	b2AABB aabb;
 	aabb.lowerBound = v2_to_b2(a);
 	aabb.upperBound = v2_to_b2(b);
-	state->world->QueryAABB(&callback, aabb);
+	state->sim.world->QueryAABB(&callback, aabb);
 	return callback.platform;
 }
 
-static void platform_delete(State *state, Platform *platform) {
-	Platform *platforms = state->platforms;
-	u32 nplatforms = state->nplatforms;
+static void platform_delete(SimContext *sim, Platform *platform) {
+	Platform *platforms = sim->platforms;
+	u32 nplatforms = sim->nplatforms;
 	u32 index = (u32)(platform - platforms);
 	
-	state->world->DestroyBody(platforms[index].body);
+	platform_remove_body(sim, &platforms[index]);
 
 	if (index+1 < nplatforms) {
 		// set this platform to last platform
@@ -270,7 +343,7 @@ static void platform_delete(State *state, Platform *platform) {
 		// platform is at end of array; don't need to do anything special
 		memset(&platforms[index], 0, sizeof(Platform));
 	}
-	--state->nplatforms;
+	--sim->nplatforms;
 
 }
 
@@ -310,6 +383,28 @@ static void platform_write_to_file(Platform const *p, FILE *fp) {
 	}
 }
 
+#define PLATFORM_WRITE_MAX_SIZE 37 // the most bytes platform_write_to_memory can write
+
+// write p to data, in the same format as platform_write_to_file. returns the end of what was written.
+static u8 *platform_write_to_memory(Platform const *p, u8 *data) {
+	u8 flags = (u8)(p->moves * 1) | (u8)(p->rotates * 2);
+	memcpy(data, &p->radius, 4); data += 4;
+	memcpy(data, &p->start_angle, 4); data += 4;
+	memcpy(data, &p->color, 4); data += 4;
+	*data++ = flags;
+	if (p->moves) {
+		memcpy(data, &p->move_speed, 4); data += 4;
+		memcpy(data, &p->move_p1, 8); data += 8;
+		memcpy(data, &p->move_p2, 8); data += 8;
+	} else {
+		memcpy(data, &p->center, 8); data += 8;
+	}
+	if (p->rotates) {
+		memcpy(data, &p->rotate_speed, 4); data += 4;
+	}
+	return data;
+}
+
 static void platform_read_from_file(Platform *p, FILE *fp) {
 	p->radius = fread_float(fp);
 	p->start_angle = fread_float(fp);
@@ -332,81 +427,106 @@ static void platform_read_from_file(Platform *p, FILE *fp) {
 	}
 }
 
-static v2 setup_rand_point(void);
+// like platform_read_from_file, but from a file that's in memory (*data is moved past the platform).
+// returns false if it goes past end.
+static bool platform_read_from_memory(Platform *p, u8 const **data, u8 const *end) {
+	u8 flags = 0;
+	bool ok = mem_read(data, end, &p->radius, 4)
+		&& mem_read(data, end, &p->start_angle, 4)
+		&& mem_read(data, end, &p->color, 4)
+		&& mem_read(data, end, &flags, 1);
+	p->moves = (flags & 1) != 0;
+	p->rotates = (flags & 2) != 0;
+
+	if (p->moves) {
+		ok = ok && mem_read(data, end, &p->move_speed, 4)
+			&& mem_read(data, end, &p->move_p1, 8)
+			&& mem_read(data, end, &p->move_p2, 8);
+	} else {
+		ok = ok && mem_read(data, end, &p->center, 8);
+	}
+
+	if (p->rotates) {
+		ok = ok && mem_read(data, end, &p->rotate_speed, 4);
+	}
+	return ok;
+}
+
+static v2 setup_rand_point(Rng *rng);
 
 #define PLATFORM_MOVE_CHANCE 0.5f // chance that the platform will be a moving one
 #define PLATFORM_ROTATE_CHANCE 0.5f // chance that the platform will be a rotating one (platforms can be moving and rotating)
 
-static void platform_random(Platform *platform) {
+static void platform_random(Rng *rng, Platform *platform) {
 	do {
-		platform->color = rand_u32() | 0xFF;
+		platform->color = rand_u32(rng) | 0xFF;
 	} while (rgba_brightness(platform->color) < 0.5f); // ensure color is visible
-	platform->radius = rand_uniform(PLATFORM_RADIUS_MIN, PLATFORM_RADIUS_MAX);
-	platform->center = setup_rand_point();
-	platform->start_angle = rand_uniform(0, PIf);
+	platform->radius = rand_uniform(rng, PLATFORM_RADIUS_MIN, PLATFORM_RADIUS_MAX);
+	platform->center = setup_rand_point(rng);
+	platform->start_angle = rand_uniform(rng, 0, PIf);
 
-	if (randf() < PLATFORM_MOVE_CHANCE) {
+	if (randf(rng) < PLATFORM_MOVE_CHANCE) {
 		platform->moves = true;
-		platform->move_speed = rand_uniform(PLATFORM_MOVE_SPEED_MIN, PLATFORM_MOVE_SPEED_MAX);
+		platform->move_speed = rand_uniform(rng, PLATFORM_MOVE_SPEED_MIN, PLATFORM_MOVE_SPEED_MAX);
 		platform->move_p1 = platform->center;
-		platform->move_p2 = v2_add(platform->move_p1, v2_scale(v2_rand_unit(), 2 * rand_gauss()));
+		platform->move_p2 = v2_add(platform->move_p1, v2_scale(v2_rand_unit(rng), 2 * rand_gauss(rng)));
 	}
 
-	if (randf() < PLATFORM_ROTATE_CHANCE) {
+	if (randf(rng) < PLATFORM_ROTATE_CHANCE) {
 		platform->rotates = true;
-		platform->rotate_speed = rand_uniform(0.1f, PLATFORM_ROTATE_SPEED_MAX);
-		if (rand() % 2)
+		platform->rotate_speed = rand_uniform(rng, 0.1f, PLATFORM_ROTATE_SPEED_MAX);
+		if (rand_u32(rng) & 1)
 			platform->rotate_speed = -platform->rotate_speed; // clockwise
 	}
 }
 
-static void mutate_position(v2 *p) {
-	if (randf() < 0.2f)
-		*p = setup_rand_point(); // randomize completely
+static void mutate_position(Rng *rng, v2 *p) {
+	if (randf(rng) < 0.2f)
+		*p = setup_rand_point(rng); // randomize completely
 	else
-		*p = v2_add(*p, v2_scale(V2(rand_gauss(), rand_gauss()), 0.1f));
+		*p = v2_add(*p, v2_scale(V2(rand_gauss(rng), rand_gauss(rng)), 0.1f));
 }
 
-static void platform_mutate(State *state, Setup *setup, Platform *platform) {
+static void platform_mutate(State *state, Rng *rng, Setup *setup, Platform *platform) {
 	Platform original = *platform;
 	int i;
 	int max_attempts = 100;
 	for (i = 0; i < max_attempts; ++i) { // make at most max_attempts attempts to mutate the platform
 		*platform = original;
 
-		if (randf() < 0.2f) {
+		if (randf(rng) < 0.2f) {
 			// completely randomize platform
-			platform_random(platform);
+			platform_random(rng, platform);
 		} else {
 			// partially randomize platform
 #define FEATURE_MUTATE_RATE 0.3f
-			if (randf() < FEATURE_MUTATE_RATE) {
-				platform->start_angle += 0.3f * rand_gauss(); // mutate angle
+			if (randf(rng) < FEATURE_MUTATE_RATE) {
+				platform->start_angle += 0.3f * rand_gauss(rng); // mutate angle
 				platform->start_angle = fmodf(platform->start_angle, TAUf);
 			}
 			if (platform->moves) {
-				if (randf() < FEATURE_MUTATE_RATE) {
-					platform->move_speed += 0.1f * rand_gauss(); // mutate move speed
+				if (randf(rng) < FEATURE_MUTATE_RATE) {
+					platform->move_speed += 0.1f * rand_gauss(rng); // mutate move speed
 					platform->move_speed = clampf(platform->move_speed, PLATFORM_MOVE_SPEED_MIN, PLATFORM_MOVE_SPEED_MAX);
 				}
-				if (randf() < FEATURE_MUTATE_RATE)
-					mutate_position(&platform->move_p1); // mutate p1
-				if (randf() < FEATURE_MUTATE_RATE)
-					mutate_position(&platform->move_p2); // mutate p2
-			} else if (randf() < FEATURE_MUTATE_RATE) {
+				if (randf(rng) < FEATURE_MUTATE_RATE)
+					mutate_position(rng, &platform->move_p1); // mutate p1
+				if (randf(rng) < FEATURE_MUTATE_RATE)
+					mutate_position(rng, &platform->move_p2); // mutate p2
+			} else if (randf(rng) < FEATURE_MUTATE_RATE) {
 				// mutate position
-				mutate_position(&platform->center);
+				mutate_position(rng, &platform->center);
 			}
 			if (platform->rotates) {
-				if (randf() < FEATURE_MUTATE_RATE) {
+				if (randf(rng) < FEATURE_MUTATE_RATE) {
 					// mutate rotate speed
-					platform->rotate_speed += 0.3f * rand_gauss();
+					platform->rotate_speed += 0.3f * rand_gauss(rng);
 					platform->rotate_speed = clampf(platform->rotate_speed, PLATFORM_ROTATE_SPEED_MIN, PLATFORM_ROTATE_SPEED_MAX);
 				}
 			}
-			if (randf() < FEATURE_MUTATE_RATE) {
+			if (randf(rng) < FEATURE_MUTATE_RATE) {
 				// mutate radius
-				platform->radius += 0.1f * rand_gauss();
+				platform->radius += 0.1f * rand_gauss(rng);
 				platform->radius = clampf(platform->radius, PLATFORM_RADIUS_MIN, PLATFORM_RADIUS_MAX);
 			}
 		}
@@ -422,7 +542,7 @@ static void platform_mutate(State *state, Setup *setup, Platform *platform) {
 				}
 			}
 		}
-		if (!intersects_any && bbox.pos.x > state->left_x) break; // doesn't intersect anything; we're good.
+		if (!intersects_any && bbox.pos.x > state->sim.left_x) break; // doesn't intersect anything; we're good.
 	}
 	if (i == max_attempts) {
 		// we tried so many times but we couldn't mutate the platform ):
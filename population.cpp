@@ -0,0 +1,182 @@
+/*
+Population files (.b2p): every setup of a generation, with their scores and mutation counts, in one file.
+finish_generation writes one of these (top.b2p in the output directory) instead of a .b2s file per top setup:
+the whole file is put together in memory and written with a single fwrite (by the writer thread), because opening, writing
+and closing lots of small files a field at a time is slow on network filesystems.
+
+Format (little-endian, no padding):
+	header: magic u32, version u32, size of the whole file u64, generation (number of generations done) u64, ntop u32, nsetups u32
+	then nsetups setups: score f32, total_time f32, mutations u64, nplatforms u32, then nplatforms platforms
+	(all of each platform's fields, like run files, so that a setup behaves exactly the same when it's loaded)
+The first ntop setups are the top setups, best first.
+population_load also reads .b2s files, as a population of one setup.
+*/
+
+#define POPULATION_MAGIC 0x50533242 // "B2SP"
+#define POPULATION_VERSION 1
+#define POPULATION_HEADER_SIZE (4 + 4 + 8 + 8 + 4 + 4)
+#define POPULATION_SETUP_SIZE (4 + 4 + 8 + 4)
+#define POPULATION_PLATFORM_SIZE (8 + 4 + 4 + 4 + 1 + 4 + 8 + 8 + 4 + 4)
+
+typedef struct {
+	u64 generation; // number of generations done
+	u32 ntop; // setups[0..ntop) are the top setups, best first
+	u32 nsetups;
+	Setup *setups;
+} Population;
+
+static void population_free(Population *population) {
+	free(population->setups);
+	memset(population, 0, sizeof *population);
+}
+
+static u8 *population_put(u8 *p, void const *x, size_t size) {
+	memcpy(p, x, size);
+	return p + size;
+}
+
+static size_t population_setup_size(Setup const *setup) {
+	return POPULATION_SETUP_SIZE + setup->nplatforms * POPULATION_PLATFORM_SIZE;
+}
+
+static u8 *population_put_setup(u8 *p, Setup const *setup) {
+	p = population_put(p, &setup->score, 4);
+	p = population_put(p, &setup->total_time, 4);
+	p = population_put(p, &setup->mutations, 8);
+	p = population_put(p, &setup->nplatforms, 4);
+	for (u32 i = 0; i < setup->nplatforms; ++i) {
+		Platform const *platform = &setup->platforms[i];
+		u8 flags = (u8)(platform->moves * 1) | (u8)(platform->rotates * 2);
+		p = population_put(p, &platform->center, 8);
+		p = population_put(p, &platform->radius, 4);
+		p = population_put(p, &platform->start_angle, 4);
+		p = population_put(p, &platform->angle, 4);
+		p = population_put(p, &flags, 1);
+		p = population_put(p, &platform->move_speed, 4);
+		p = population_put(p, &platform->move_p1, 8);
+		p = population_put(p, &platform->move_p2, 8);
+		p = population_put(p, &platform->rotate_speed, 4);
+		p = population_put(p, &platform->color, 4);
+	}
+	return p;
+}
+
+// put state's setups (the top ones first), or just the top ones if top_only is set, into a population file in memory.
+// this should be called after setups_select_top. returns NULL if there isn't enough memory.
+static u8 *population_build(State *state, bool top_only, size_t *out_size) {
+	u32 ntop = state->top_kept, nsetups = top_only ? ntop : state->nsetups;
+	size_t size = POPULATION_HEADER_SIZE;
+	for (u32 i = 0; i < nsetups; ++i)
+		size += population_setup_size(&state->setups[i]);
+	u8 *data = (u8 *)malloc(size);
+	if (!data) return NULL;
+	u8 *p = data;
+	u32 magic = POPULATION_MAGIC, version = POPULATION_VERSION;
+	u64 size64 = (u64)size, generation = state->generation;
+	p = population_put(p, &magic, 4);
+	p = population_put(p, &version, 4);
+	p = population_put(p, &size64, 8);
+	p = population_put(p, &generation, 8);
+	p = population_put(p, &ntop, 4);
+	p = population_put(p, &nsetups, 4);
+	// (the top setups are setups[0..ntop), in some order)
+	for (u32 r = 0; r < ntop; ++r)
+		p = population_put_setup(p, setup_top(state, r));
+	for (u32 i = ntop; i < nsetups; ++i)
+		p = population_put_setup(p, &state->setups[i]);
+	assert(p == data + size);
+	*out_size = size;
+	return data;
+}
+
+// write state's setups (the top ones first) to <output_dir>/top.b2p (on the writer thread, see writer.cpp).
+// this should be called after setups_select_top. returns false if there isn't enough memory.
+static bool population_write(State *state) {
+	size_t size = 0;
+	u8 *data = population_build(state, false, &size);
+	if (!data) return false;
+	char filename[512] = {0};
+	snprintf(filename, sizeof filename - 1, "%s/top.b2p", state->output_dir);
+	writer_submit(&state->writer, filename, NULL, data, size);
+	return true;
+}
+
+// read a setup written by population_put_setup from *p (which is moved past it). returns false if it's invalid.
+static bool population_get_setup(u8 const **p, u8 const *end, Setup *setup) {
+	bool ok = mem_read(p, end, &setup->score, 4)
+		&& mem_read(p, end, &setup->total_time, 4)
+		&& mem_read(p, end, &setup->mutations, 8)
+		&& mem_read(p, end, &setup->nplatforms, 4)
+		&& setup->nplatforms <= MAX_PLATFORMS;
+	for (u32 j = 0; ok && j < setup->nplatforms; ++j) {
+		Platform *platform = &setup->platforms[j];
+		u8 flags = 0;
+		ok = mem_read(p, end, &platform->center, 8)
+			&& mem_read(p, end, &platform->radius, 4)
+			&& mem_read(p, end, &platform->start_angle, 4)
+			&& mem_read(p, end, &platform->angle, 4)
+			&& mem_read(p, end, &flags, 1)
+			&& mem_read(p, end, &platform->move_speed, 4)
+			&& mem_read(p, end, &platform->move_p1, 8)
+			&& mem_read(p, end, &platform->move_p2, 8)
+			&& mem_read(p, end, &platform->rotate_speed, 4)
+			&& mem_read(p, end, &platform->color, 4);
+		platform->moves = (flags & 1) != 0;
+		platform->rotates = (flags & 2) != 0;
+	}
+	return ok;
+}
+
+// parse a population file which has been read into data. returns false if it's invalid.
+static bool population_parse(u8 const *data, size_t size, Population *population) {
+	memset(population, 0, sizeof *population);
+	u8 const *p = data, *end = data + size;
+	u32 magic = 0, version = 0;
+	u64 file_size = 0;
+	bool ok = mem_read(&p, end, &magic, 4) && magic == POPULATION_MAGIC
+		&& mem_read(&p, end, &version, 4) && version == POPULATION_VERSION
+		&& mem_read(&p, end, &file_size, 8) && file_size == (u64)size
+		&& mem_read(&p, end, &population->generation, 8)
+		&& mem_read(&p, end, &population->ntop, 4)
+		&& mem_read(&p, end, &population->nsetups, 4)
+		&& population->ntop <= population->nsetups
+		// (every setup takes at least POPULATION_SETUP_SIZE bytes, so this stops huge allocations for bad files)
+		&& population->nsetups <= (size - POPULATION_HEADER_SIZE) / POPULATION_SETUP_SIZE;
+	if (!ok) return false;
+	population->setups = calloc_arr(Setup, population->nsetups);
+	ok = population->nsetups == 0 || population->setups;
+	for (u32 i = 0; ok && i < population->nsetups; ++i)
+		ok = population_get_setup(&p, end, &population->setups[i]);
+	ok = ok && p == end;
+	if (!ok) population_free(population);
+	return ok;
+}
+
+// read a population file, or a .b2s file (as a population of one setup, with no score).
+// the file is mapped into memory and parsed straight from there.
+// returns false if the file couldn't be read or is invalid.
+static bool population_load(Population *population, char const *filename) {
+	memset(population, 0, sizeof *population);
+	MappedFile map = {};
+	if (!file_map(&map, filename)) {
+		logln("Couldn't read setups from %s.", filename);
+		return false;
+	}
+	bool ok;
+	u8 const *p = map.data, *end = map.data + map.size;
+	u32 magic = 0;
+	if (map.size >= 4) memcpy(&magic, map.data, 4);
+	if (magic == POPULATION_MAGIC) {
+		ok = population_parse(map.data, map.size, population);
+	} else {
+		population->setups = calloc_object(Setup);
+		ok = population->setups && setup_read_from_memory(population->setups, &p, end);
+		if (ok) population->ntop = population->nsetups = 1;
+		else population_free(population);
+	}
+	file_unmap(&map);
+	if (!ok) {
+		logln("Invalid setup file: %s.", filename);
+	}
+	return ok;
+}
@@ -0,0 +1,179 @@
+/*
+Run files: everything needed to carry on with an evolution run after the process exits.
+That's the settings which decide what happens next (seed, generation, population size, mutation groups,
+whether it's a Pareto or novelty run), the whole population with its scores, and the Pareto and novelty
+archives. There's no random number generator state to save, because every new setup gets its own generator from setup_rng(seed, generation, index).
+Records (see incremental.cpp) and the fitness cache aren't saved. They only make scoring faster.
+Setups are saved like in population files (see population.cpp), with all of their platforms' fields
+(unlike .b2s files), so that a resumed run simulates exactly the same things the original one would have.
+The file is put together in memory and written all at once, like population files.
+*/
+
+#define RUN_MAGIC 0x52533242 // "B2SR"
+#define RUN_VERSION 4
+#define RUN_HEADER_SIZE (4 + 4 + 8 + 8 + 4 + 4 + 1 + 4)
+#define RUN_GROUP_SIZE (4 + 4 + 8 + 8)
+#define RUN_NOVELTY_SIZE (1 + 4 + 4 + 4 + 4) // then 8 bytes for each behaviour in the archive
+#define RUN_SETUP_EXTRA_SIZE (4 + 1) // group and pruned, after what population_put_setup puts
+
+static u8 *run_put_setup(u8 *p, Setup const *setup) {
+	u8 pruned = setup->pruned;
+	p = population_put_setup(p, setup);
+	p = population_put(p, &setup->group, 4);
+	return population_put(p, &pruned, 1);
+}
+
+// returns false if the setup is invalid
+static bool run_get_setup(u8 const **p, u8 const *end, Setup *setup, u32 nmutation_groups) {
+	u8 pruned = 0;
+	bool ok = population_get_setup(p, end, setup)
+		&& mem_read(p, end, &setup->group, 4)
+		&& mem_read(p, end, &pruned, 1)
+		&& setup->group <= nmutation_groups;
+	setup->pruned = pruned != 0;
+	return ok;
+}
+
+// put the run into a file in memory. returns NULL if there isn't enough memory.
+static u8 *run_build(State const *state, size_t *out_size) {
+	size_t size = RUN_HEADER_SIZE + state->nmutation_groups * RUN_GROUP_SIZE + state->top_kept * 4 + 4 + 4;
+	for (u32 i = 0; i < state->nsetups; ++i)
+		size += population_setup_size(&state->setups[i]) + RUN_SETUP_EXTRA_SIZE;
+	for (u32 i = 0; i < state->npareto_archive; ++i)
+		size += population_setup_size(&state->pareto_archive[i]) + RUN_SETUP_EXTRA_SIZE;
+	NoveltyArchive const *novelty = &state->novelty_archive;
+	size += RUN_NOVELTY_SIZE + (size_t)novelty->n * 8;
+	u8 *data = (u8 *)malloc(size);
+	if (!data) return NULL;
+	u8 *p = data;
+	u32 magic = RUN_MAGIC, version = RUN_VERSION;
+	u8 pareto = state->pareto;
+	p = population_put(p, &magic, 4);
+	p = population_put(p, &version, 4);
+	p = population_put(p, &state->seed, 8);
+	p = population_put(p, &state->generation, 8);
+	p = population_put(p, &state->generation_size, 4);
+	p = population_put(p, &state->top_kept, 4);
+	p = population_put(p, &pareto, 1);
+	p = population_put(p, &state->nmutation_groups, 4);
+	for (u32 g = 0; g < state->nmutation_groups; ++g) {
+		MutationGroup const *group = &state->mutation_groups[g];
+		p = population_put(p, &group->weight, 4);
+		p = population_put(p, &group->mutation_rate, 4);
+		p = population_put(p, &group->trials, 8);
+		p = population_put(p, &group->wins, 8);
+	}
+	p = population_put(p, state->top, state->top_kept * 4);
+	for (u32 i = 0; i < state->nsetups; ++i)
+		p = run_put_setup(p, &state->setups[i]);
+	p = population_put(p, &state->npareto_archive, 4);
+	for (u32 i = 0; i < state->npareto_archive; ++i)
+		p = run_put_setup(p, &state->pareto_archive[i]);
+	u8 novelty_on = state->novelty;
+	p = population_put(p, &novelty_on, 1);
+	p = population_put(p, &state->novelty_weight, 4);
+	p = population_put(p, &novelty->add_threshold, 4);
+	p = population_put(p, &novelty->nadded, 4);
+	p = population_put(p, &novelty->n, 4);
+	p = population_put(p, novelty->behaviours, (size_t)novelty->n * 8);
+	p = population_put(p, &magic, 4); // so we can tell if the file got cut off
+	assert(p == data + size);
+	*out_size = size;
+	return data;
+}
+
+// save the run to filename. this should be called between generations.
+// the file is replaced all at once, so if we crash while saving, the last run file is still there.
+static bool run_save(State const *state, char const *filename) {
+	size_t size = 0;
+	u8 *data = run_build(state, &size);
+	if (!data) return false;
+	char tmp_filename[512] = {0};
+	snprintf(tmp_filename, sizeof tmp_filename - 1, "%s.tmp", filename);
+	FILE *fp = fopen(tmp_filename, "wb");
+	bool success = fp != NULL;
+	if (fp) {
+		success = fwrite(data, 1, size, fp) == size && file_sync(fp);
+		success &= fclose(fp) == 0;
+	}
+	if (success) success = file_replace(tmp_filename, filename);
+	if (!success) {
+		logln("Couldn't write run to %s.", filename);
+		remove(tmp_filename);
+	}
+	free(data);
+	return success;
+}
+
+// carry on with the run saved in filename, instead of calling start_evolution.
+// the seed, generation, population size, mutation groups, state->pareto and the novelty settings
+// are replaced with the ones in the file.
+// returns false if the file couldn't be read, or if it's invalid (in which case state's setups are freed).
+static bool run_load(State *state, char const *filename) {
+	MappedFile map = {};
+	if (!file_map(&map, filename)) return false;
+	u8 const *p = map.data, *end = map.data + map.size;
+	u32 magic = 0, version = 0;
+	u8 pareto = 0;
+	bool ok = mem_read(&p, end, &magic, 4) && magic == RUN_MAGIC
+		&& mem_read(&p, end, &version, 4) && version == RUN_VERSION
+		&& mem_read(&p, end, &state->seed, 8)
+		&& mem_read(&p, end, &state->generation, 8)
+		&& mem_read(&p, end, &state->generation_size, 4)
+		&& mem_read(&p, end, &state->top_kept, 4)
+		&& mem_read(&p, end, &pareto, 1)
+		&& mem_read(&p, end, &state->nmutation_groups, 4)
+		&& state->generation_size >= 1 && state->top_kept >= 1
+		&& state->nmutation_groups >= 1 && state->nmutation_groups <= MAX_MUTATION_GROUPS;
+	state->pareto = pareto != 0;
+	for (u32 g = 0; ok && g < state->nmutation_groups; ++g) {
+		MutationGroup *group = &state->mutation_groups[g];
+		memset(group, 0, sizeof *group);
+		ok = mem_read(&p, end, &group->weight, 4)
+			&& mem_read(&p, end, &group->mutation_rate, 4)
+			&& mem_read(&p, end, &group->trials, 8)
+			&& mem_read(&p, end, &group->wins, 8);
+	}
+	ok = ok && evolution_alloc(state);
+	for (u32 r = 0; ok && r < state->top_kept; ++r)
+		ok = mem_read(&p, end, &state->top[r], 4) && state->top[r] < state->top_kept;
+	for (u32 i = 0; ok && i < state->nsetups; ++i)
+		ok = run_get_setup(&p, end, &state->setups[i], state->nmutation_groups);
+	u32 narchive = 0;
+	ok = ok && mem_read(&p, end, &narchive, 4) && narchive <= PARETO_ARCHIVE_SIZE;
+	if (ok && narchive) {
+		state->pareto_archive = calloc_arr(Setup, narchive);
+		ok = state->pareto_archive != NULL;
+	}
+	for (u32 i = 0; ok && i < narchive; ++i)
+		ok = run_get_setup(&p, end, &state->pareto_archive[i], state->nmutation_groups);
+	if (ok) state->npareto_archive = narchive;
+	// (the novelty archive is rebuilt by adding its behaviours in the same order, which gives the same archive)
+	u8 novelty_on = 0;
+	float add_threshold = 0;
+	u32 nadded = 0, nbehaviours = 0;
+	ok = ok && mem_read(&p, end, &novelty_on, 1)
+		&& mem_read(&p, end, &state->novelty_weight, 4)
+		&& mem_read(&p, end, &add_threshold, 4)
+		&& mem_read(&p, end, &nadded, 4)
+		&& mem_read(&p, end, &nbehaviours, 4)
+		&& nbehaviours <= (size_t)(end - p) / 8;
+	state->novelty = novelty_on != 0;
+	for (u32 i = 0; ok && i < nbehaviours; ++i) {
+		v2 behaviour;
+		ok = mem_read(&p, end, &behaviour, 8) && novelty_archive_add(&state->novelty_archive, behaviour);
+	}
+	state->novelty_archive.add_threshold = add_threshold;
+	state->novelty_archive.nadded = nadded;
+	ok = ok && mem_read(&p, end, &magic, 4) && magic == RUN_MAGIC && p == end;
+	file_unmap(&map);
+	if (!ok) {
+		logln("Invalid run file: %s.", filename);
+		evolution_free(state);
+		return false;
+	}
+	fitness_cache_clear(state);
+	state->scoring_next = 0;
+	state->evolve_menu = true;
+	return true;
+}
@@ -0,0 +1,186 @@
+// scoring setups on multiple threads
+
+/*
+Scoring setups takes very different amounts of time (the ball might fall straight down, or it might
+bounce around for a while), so each thread starts with an equal-sized chunk of the setups,
+and when it runs out, it steals setups from the other threads.
+Each thread's chunk is a deque of setup indices [top, bottom). The thread that owns it takes setups from
+the bottom, and other threads steal from the top (this is a Chase-Lev deque, but since nothing is added
+to it after scoring starts, we don't need an array of items, just the two indices).
+*/
+typedef struct ScoringWorker {
+	i32 volatile top, bottom;
+	SimContext *sim; // where this worker simulates setups
+	// all of the setups being scored (see setups_score_parallel)
+	Setup *setups;
+	SetupRecord *records;
+	u32 const *indices;
+	struct ScoringWorker *workers; // all of the workers (so we can steal from them)
+	u32 index, nworkers;
+	ScoringThreadStats stats;
+	char padding[64]; // keep top/bottom of different workers in different cache lines
+} ScoringWorker;
+
+#define SCORING_DEQUE_EMPTY (-1)
+#define SCORING_DEQUE_ABORT (-2) // lost a race with another thread; try again
+
+// take a setup index from the bottom of our own deque
+static i32 scoring_deque_pop(ScoringWorker *worker) {
+	i32 b = atomic_load_i32(&worker->bottom) - 1;
+	atomic_store_i32(&worker->bottom, b);
+	i32 t = atomic_load_i32(&worker->top);
+	if (t > b) {
+		// deque was empty
+		atomic_store_i32(&worker->bottom, t);
+		return SCORING_DEQUE_EMPTY;
+	}
+	if (t == b) {
+		// last one; make sure no one steals it first
+		bool won = atomic_cas_i32(&worker->top, t, t + 1);
+		atomic_store_i32(&worker->bottom, t + 1);
+		return won ? b : SCORING_DEQUE_EMPTY;
+	}
+	return b;
+}
+
+// take a setup index from the top of someone else's deque
+static i32 scoring_deque_steal(ScoringWorker *victim) {
+	i32 t = atomic_load_i32(&victim->top);
+	i32 b = atomic_load_i32(&victim->bottom);
+	if (t >= b) return SCORING_DEQUE_EMPTY;
+	if (!atomic_cas_i32(&victim->top, t, t + 1)) return SCORING_DEQUE_ABORT;
+	return t;
+}
+
+// returns the index of a setup to score next, or -1 if there are none left
+static i32 scoring_worker_next(ScoringWorker *worker) {
+	i32 i = scoring_deque_pop(worker);
+	if (i >= 0) return i;
+	// steal from the other threads, starting with our neighbour
+	u32 n = worker->nworkers;
+	for (u32 k = 1; k < n; ++k) {
+		ScoringWorker *victim = &worker->workers[(worker->index + k) % n];
+		do
+			i = scoring_deque_steal(victim);
+		while (i == SCORING_DEQUE_ABORT);
+		if (i >= 0) {
+			++worker->stats.nstolen;
+			return i;
+		}
+	}
+	return -1; // nothing left anywhere (no new setups are added once scoring starts)
+}
+
+static void scoring_worker_run(void *worker_void) {
+	ScoringWorker *worker = (ScoringWorker *)worker_void;
+	i32 i;
+	while ((i = scoring_worker_next(worker)) >= 0) {
+		struct timespec start = time_get();
+		u32 s = worker->indices ? worker->indices[i] : (u32)i;
+		setup_score(worker->sim, &worker->setups[s], worker->records ? &worker->records[s] : NULL);
+		worker->stats.busy_time += timespec_sub(time_get(), start);
+		++worker->stats.nscored;
+	}
+}
+
+// get the SimContext the i'th scoring thread should simulate in, allocating it if necessary.
+// the first thread's is part of the State, so this never returns NULL for i = 0.
+static SimContext *scoring_thread_sim(State *state, u32 i) {
+	SimContext *sim = i ? state->thread_sims[i] : &state->scoring_sim;
+	if (!sim) {
+		sim = state->thread_sims[i] = calloc_object(SimContext);
+		if (!sim) return NULL;
+	}
+	if (!sim->contact_listener) sim_init(sim);
+	return sim;
+}
+
+static void scoring_threads_free(State *state) {
+	for (u32 i = 1; i < MAX_THREADS; ++i) {
+		SimContext *sim = state->thread_sims[i];
+		if (sim) {
+			sim_free(sim);
+			free(sim);
+			state->thread_sims[i] = NULL;
+		}
+	}
+	if (state->scoring_sim.contact_listener) sim_free(&state->scoring_sim);
+}
+
+// score setups[indices[0]], ..., setups[indices[nsetups-1]] (or setups[0..nsetups) if indices is NULL)
+// on state->nthreads threads. if records isn't NULL, what happens to setups[i] is recorded in records[i].
+// afterwards, state->thread_stats says how long each thread was busy/idle for.
+static void setups_score_parallel(State *state, Setup *setups, SetupRecord *records, u32 const *indices, u32 nsetups) {
+	u32 nthreads = state->nthreads;
+	if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+	if (nthreads > nsetups) nthreads = nsetups;
+	if (nthreads < 1) nthreads = 1;
+	// setups are never scored in state->sim, even on one thread,
+	// so that the GUI can keep simulating in it while setups are scored in the background.
+	SimContext *sims[MAX_THREADS] = {};
+	for (u32 t = 0; t < nthreads; ++t) {
+		SimContext *sim = sims[t] = scoring_thread_sim(state, t);
+		if (!sim) {
+			nthreads = t; // out of memory; just use the threads we've got
+			break;
+		}
+		sim->ballistic_exit = state->ballistic_exit;
+		sim->pool_bodies = state->pool_bodies;
+		sim->prune = state->pruning;
+		if (state->pruning) sim->prune_score = setup_top(state, state->top_kept - 1)->score;
+	}
+	ScoringWorker *workers = nthreads > 1 ? calloc_arr(ScoringWorker, nthreads) : NULL;
+	struct timespec start = time_get();
+
+	if (!workers) {
+		// just score them all on this thread
+		SimContext *sim = sims[0];
+		for (u32 i = 0; i < nsetups; ++i) {
+			u32 s = indices ? indices[i] : i;
+			setup_score(sim, &setups[s], records ? &records[s] : NULL);
+		}
+		ScoringThreadStats *stats = &state->thread_stats[0];
+		memset(stats, 0, sizeof *stats);
+		stats->nscored = nsetups;
+		stats->busy_time = timespec_sub(time_get(), start);
+		state->nthread_stats = 1;
+		return;
+	}
+
+	u32 next = 0;
+	for (u32 t = 0; t < nthreads; ++t) {
+		ScoringWorker *worker = &workers[t];
+		u32 count = nsetups / nthreads + (t < nsetups % nthreads);
+		worker->top = (i32)next;
+		worker->bottom = (i32)(next + count);
+		worker->sim = sims[t];
+		worker->setups = setups;
+		worker->records = records;
+		worker->indices = indices;
+		worker->workers = workers;
+		worker->index = t;
+		worker->nworkers = nthreads;
+		next += count;
+	}
+	assert(next == nsetups);
+
+	Thread threads[MAX_THREADS] = {};
+	bool thread_created[MAX_THREADS] = {};
+	// this thread is worker 0
+	for (u32 t = 1; t < nthreads; ++t)
+		thread_created[t] = thread_create(&threads[t], scoring_worker_run, &workers[t]);
+	scoring_worker_run(&workers[0]);
+	for (u32 t = 1; t < nthreads; ++t)
+		if (thread_created[t])
+			thread_join(threads[t]);
+	// (if a thread couldn't be created, the others will have stolen all of its setups)
+
+	double total_time = timespec_sub(time_get(), start);
+	for (u32 t = 0; t < nthreads; ++t) {
+		ScoringThreadStats *stats = &state->thread_stats[t];
+		*stats = workers[t].stats;
+		stats->idle_time = total_time - stats->busy_time;
+	}
+	state->nthread_stats = nthreads;
+	free(workers);
+}
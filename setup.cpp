@@ -4,10 +4,10 @@
 #define SETUP_MIN_Y 1.0f
 #define SETUP_MAX_Y 15.0f
 
-static v2 setup_rand_point(void) {
+static v2 setup_rand_point(Rng *rng) {
 	return V2(
-		rand_uniform(SETUP_MIN_X, SETUP_MAX_X),
-		rand_uniform(SETUP_MIN_Y, SETUP_MAX_Y)
+		rand_uniform(rng, SETUP_MIN_X, SETUP_MAX_X),
+		rand_uniform(rng, SETUP_MIN_Y, SETUP_MAX_Y)
 	);
 }
 #if 0
@@ -57,7 +57,7 @@ static void setup_random(Setup *setup, float cost_allowed) {
 }
 #endif
 
-static void setup_random(State *state, Setup *setup) {
+static void setup_random(State *state, Rng *rng, Setup *setup) {
 	u32 i, j, t;
 	u32 const max_failed_attempts = 100;
 	Platform *platforms = setup->platforms;
@@ -65,7 +65,7 @@ static void setup_random(State *state, Setup *setup) {
 		for (t = 0; t < max_failed_attempts; ++t) {
 			Platform *platform = &platforms[i];
 			memset(platform, 0, sizeof *platform);
-			platform_random(platform);
+			platform_random(rng, platform);
 			Rect bbox = platform_bounding_box(platform);
 			for (j = 0; j < i; ++j) {
 				Rect bbox_other = platform_bounding_box(&platforms[j]);
@@ -73,7 +73,7 @@ static void setup_random(State *state, Setup *setup) {
 					break;
 				}
 			}
-			if (bbox.pos.x > state->left_x // ensure that platform is to the right of left wall
+			if (bbox.pos.x > state->sim.left_x // ensure that platform is to the right of left wall
 				&& j == i) {
 				// we successfully placed a platform!
 				break;
@@ -88,36 +88,45 @@ static void setup_random(State *state, Setup *setup) {
 	setup->nplatforms = i;
 }
 
-static void setup_reset(State *state) {
+static void setup_reset(SimContext *sim) {
 	{ // reset ball
-		Ball *ball = &state->ball;
-		b2World *world = state->world;
-		if (ball->body)
-			world->DestroyBody(ball->body);
+		Ball *ball = &sim->ball;
+		b2World *world = sim->world;
+		ball_remove_body(sim);
 
 
-		ball->radius = 0.3f;
+		ball->radius = BALL_RADIUS;
 		ball->pos = BALL_STARTING_POS;
 
-		// create ball
-		b2BodyDef ball_def;
-		ball_def.type = b2_dynamicBody;
-		ball_def.position.Set(ball->pos.x, ball->pos.y);
-		b2Body *ball_body = ball->body = world->CreateBody(&ball_def);
+		if (sim->ball_body_pool) {
+			// reuse pooled ball body
+			b2Body *ball_body = ball->body = sim->ball_body_pool;
+			sim->ball_body_pool = NULL;
+			ball_body->SetTransform(b2Vec2(ball->pos.x, ball->pos.y), 0);
+			ball_body->SetLinearVelocity(b2Vec2(0, 0));
+			ball_body->SetAngularVelocity(0);
+			ball_body->SetEnabled(true);
+			ball_body->SetAwake(true);
+		} else {
+			// create ball
+			b2BodyDef ball_def;
+			ball_def.type = b2_dynamicBody;
+			ball_def.position.Set(ball->pos.x, ball->pos.y);
+			b2Body *ball_body = ball->body = world->CreateBody(&ball_def);
 		
-		b2CircleShape ball_shape;
-		ball_shape.m_radius = ball->radius;
+			b2CircleShape ball_shape;
+			ball_shape.m_radius = ball->radius;
 
-		b2FixtureDef ball_fixture;
-		ball_fixture.shape = &ball_shape;
-		ball_fixture.density = 1.0f;
-		ball_fixture.friction = 0.3f;
-		ball_fixture.restitution = 0.6f; // bounciness
-
-		ball_body->CreateFixture(&ball_fixture);
+			b2FixtureDef ball_fixture;
+			ball_fixture.shape = &ball_shape;
+			ball_fixture.density = 1.0f;
+			ball_fixture.friction = BALL_FRICTION;
+			ball_fixture.restitution = BALL_RESTITUTION;
 
+			ball_body->CreateFixture(&ball_fixture);
+		}
 	}
-	for (Platform *platform = state->platforms, *end = platform + state->nplatforms; platform != end; ++platform) { // reset platforms
+	for (Platform *platform = sim->platforms, *end = platform + sim->nplatforms; platform != end; ++platform) { // reset platforms
 		b2Body *body = platform->body;
 		assert(body);
 		platform->angle = platform->start_angle;
@@ -132,54 +141,154 @@ static void setup_reset(State *state) {
 		} 
 		body->SetAngularVelocity(platform->rotate_speed);
 	}
-	state->setting_move_p2 = false;
-	state->furthest_ball_x_pos = 0;
-	state->stuck_time = 0;
-	state->total_time = 0;
-	state->time_residue = 0;
+	sim->furthest_ball_x_pos = 0;
+	sim->stuck_time = 0;
+	sim->total_time = 0;
+	sim->time_residue = 0;
+	// leave some room for the platforms' thickness, Box2D's polygon skin,
+	// and moving platforms going a bit past their endpoints
+	sim->platforms_right_x = platforms_starting_line(sim->platforms, sim->nplatforms)
+		+ sim->platform_thickness + 0.1f;
+	sim->kinematic_bottom_y = INFINITY;
+	for (Platform const *platform = sim->platforms, *end = platform + sim->nplatforms; platform != end; ++platform) {
+		if (!platform->moves && !platform->rotates) continue;
+		float y = platform->moves ? minf(platform->move_p1.y, platform->move_p2.y) : platform->center.y;
+		// (again leaving room for moving platforms going past their endpoints)
+		y -= platform->radius + sim->platform_thickness + 0.1f;
+		if (y < sim->kinematic_bottom_y) sim->kinematic_bottom_y = y;
+	}
+	sim->ballistic_exited = false;
+	sim->pruned = false;
+	sim->nsteps = 0;
 }
 
 // make this setup the active one
-static void setup_use(State *state, Setup *setup) {
-	b2World *world = state->world;
+static void setup_use(SimContext *sim, Setup const *setup) {
+	b2World *world = sim->world;
 	// get rid of old platform bodies
-	for (u32 i = 0; i < state->nplatforms; ++i) {
-		Platform *p = &state->platforms[i];
-		if (p->body)
-			world->DestroyBody(p->body);
+	for (u32 i = 0; i < sim->nplatforms; ++i) {
+		platform_remove_body(sim, &sim->platforms[i]);
 	}
-	memcpy(state->platforms, setup->platforms, setup->nplatforms * sizeof(Platform));
-	state->nplatforms = setup->nplatforms;
+	memcpy(sim->platforms, setup->platforms, setup->nplatforms * sizeof(Platform));
+	sim->nplatforms = setup->nplatforms;
 	// create new bodies
-	for (u32 i = 0; i < state->nplatforms; ++i) {
-		Platform *p = &state->platforms[i];
+	for (u32 i = 0; i < sim->nplatforms; ++i) {
+		Platform *p = &sim->platforms[i];
 		p->body = NULL;
-		platform_make_body(state, p, i);
+		platform_make_body(sim, p, i);
 	}
-	assert((u32)world->GetBodyCount() == state->nplatforms + 2); // platforms + 2 walls
-	setup_reset(state);
+	// platforms + 2 walls + pooled bodies
+	assert((u32)world->GetBodyCount() == sim->nplatforms + 2 + sim->nplatform_body_pool + (sim->ball_body_pool != NULL));
+	(void)world;
+	setup_reset(sim);
+}
+
+// copy the parts of src which are being used (a SetupRecord is mostly checkpoints, most of which usually aren't)
+static void setup_record_copy(SetupRecord *dst, SetupRecord const *src, u32 nplatforms) {
+	memcpy(dst, src, offsetof(SetupRecord, boxes));
+	memcpy(dst->boxes, src->boxes, src->nboxes * sizeof(Rect));
+	dst->checkpoint_every = src->checkpoint_every;
+	dst->ncheckpoints = src->ncheckpoints;
+	for (u32 c = 0; c < src->ncheckpoints; ++c)
+		memcpy(&dst->checkpoints[c], &src->checkpoints[c],
+			offsetof(SimCheckpoint, platforms) + nplatforms * sizeof(BodyCheckpoint));
+}
+
+static void setup_record_clear(SetupRecord *record) {
+	memset(record, 0, offsetof(SetupRecord, boxes));
+	record->ncheckpoints = 0;
 }
 
-static float setup_score(State *state, Setup *setup) {
-	setup_use(state, setup);
-	Ball *ball = &state->ball;
+// simulate setup, and set its score. if record isn't NULL, what happens is recorded in it
+// (starting from one of its checkpoints if record->resume_checkpoint is set, see incremental.cpp).
+static float setup_score(SimContext *sim, Setup *setup, SetupRecord *record) {
+	// use a new world for every setup, so that the score doesn't depend on what was simulated before it.
+	// (Box2D's broad-phase remembers some things, which can change the order contacts are solved in.)
+	if (!sim->pool_bodies) {
+		world_destroy(sim);
+		world_create(sim);
+	}
+	setup_use(sim, setup);
+	Ball *ball = &sim->ball;
 	float starting_line = platforms_starting_line(setup->platforms, setup->nplatforms);
+	sim->prune_x = starting_line + sim->prune_score;
+	sim->record = record != NULL;
+	u32 resume = record ? record->resume_checkpoint : 0, resumed_step = 0;
+	if (resume) {
+		resumed_step = record->checkpoints[resume - 1].step;
+		sim_record_resume(sim, record, resume - 1);
+		// finish off the simulate_time call the checkpoint was taken in
+		simulate_time(sim, 0);
+	} else if (record) {
+		sim_record_start(sim);
+		sim_record_ball(sim, ball->pos);
+	}
+	if (sim->trajectory) {
+		assert(!sim->ballistic_exit && !sim->prune);
+		trajectory_start(sim->trajectory, sim);
+		trajectory_add_frame(sim);
+	}
 	while (ball->body) {
-		simulate_time(state, 0.1f);
+		simulate_time(sim, 0.1f);
 	}
+	if (sim->trajectory) trajectory_add_frame(sim); // where the ball ended up
 	setup->score = ball->pos.x - starting_line;
-	setup->total_time = state->total_time;
+	setup->total_time = sim->total_time;
+	setup->nsteps = sim->nsteps;
+	setup->pruned = sim->pruned;
+	if (record) {
+		if (!sim->pruned) {
+			sim->record_current.touched = sim->contact_listener->touched;
+			setup_record_copy(record, &sim->record_current, setup->nplatforms);
+			record->resumed_step = resumed_step;
+		} else {
+			record->valid = false;
+		}
+		record->reused = false;
+		record->resume_checkpoint = 0;
+		record->resume_replay = 0;
+	}
+	sim->record = false;
 	return setup->score;
 }
 
+// write setup to fp, in the .b2s format
+static void setup_write(Setup const *setup, FILE *fp) {
+	u32 nplatforms = setup->nplatforms;
+	fwrite_u32(fp, nplatforms);
+	for (u32 i = 0; i < nplatforms; ++i) {
+		platform_write_to_file(&setup->platforms[i], fp);
+	}
+}
+
+// read a setup written by setup_write. returns false if it's invalid.
+static bool setup_read(Setup *setup, FILE *fp) {
+	u32 nplatforms = fread_u32(fp);
+	if (nplatforms > MAX_PLATFORMS) return false;
+	setup->nplatforms = nplatforms;
+	for (u32 i = 0; i < nplatforms; ++i) {
+		platform_read_from_file(&setup->platforms[i], fp);
+	}
+	return !ferror(fp) && !feof(fp);
+}
+
+// encode setup in the .b2s format into a malloc'd buffer. returns NULL if there isn't enough memory.
+static u8 *setup_write_to_memory(Setup const *setup, size_t *out_size) {
+	u32 nplatforms = setup->nplatforms;
+	u8 *data = (u8 *)malloc(4 + nplatforms * PLATFORM_WRITE_MAX_SIZE);
+	if (!data) return NULL;
+	memcpy(data, &nplatforms, 4);
+	u8 *p = data + 4;
+	for (u32 i = 0; i < nplatforms; ++i)
+		p = platform_write_to_memory(&setup->platforms[i], p);
+	*out_size = (size_t)(p - data);
+	return data;
+}
+
 static bool setup_write_to_file(Setup const *setup, char const *filename) {
 	FILE *fp = fopen(filename, "wb");
 	if (fp) {
-		u32 nplatforms = setup->nplatforms;
-		fwrite_u32(fp, nplatforms);
-		for (u32 i = 0; i < nplatforms; ++i) {
-			platform_write_to_file(&setup->platforms[i], fp);
-		}
+		setup_write(setup, fp);
 		fclose(fp);
 		return true;
 	} else {
@@ -188,41 +297,141 @@ static bool setup_write_to_file(Setup const *setup, char const *filename) {
 	}
 }
 
+// like setup_read, but from a file that's in memory (*data is moved past the setup)
+static bool setup_read_from_memory(Setup *setup, u8 const **data, u8 const *end) {
+	u32 nplatforms = 0;
+	if (!mem_read(data, end, &nplatforms, 4) || nplatforms > MAX_PLATFORMS) return false;
+	setup->nplatforms = nplatforms;
+	for (u32 i = 0; i < nplatforms; ++i) {
+		if (!platform_read_from_memory(&setup->platforms[i], data, end))
+			return false;
+	}
+	return true;
+}
+
+// read a .b2s file. the file is mapped into memory and decoded from there,
+// rather than going through stdio a field at a time (which is slow when loading lots of setups).
 static bool setup_read_from_file(Setup *setup, char const *filename) {
-	FILE *fp = fopen(filename, "rb");
-	if (fp) {
-		u32 nplatforms = setup->nplatforms = fread_u32(fp);
-		for (u32 i = 0; i < nplatforms; ++i) {
-			platform_read_from_file(&setup->platforms[i], fp);
+	MappedFile map = {};
+	if (file_map(&map, filename)) {
+		u8 const *p = map.data;
+		bool success = setup_read_from_memory(setup, &p, map.data + map.size);
+		file_unmap(&map);
+		if (!success) {
+			logln("Invalid setup file: %s.", filename);
 		}
-		fclose(fp);
-		return true;
+		return success;
 	} else {
 		logln("Couldn't read setup from %s.", filename);
 		return false;
 	}
 }
 
-// meant for use with qsort, to sort by descending score
-static int setup_compare_scores(void const *a_void, void const *b_void) {
-	Setup const *a = (Setup const *)a_void, *b = (Setup const *)b_void;
-	if (a->score > b->score) {
-		return -1;
-	} else if (a->score < b->score) {
-		return +1;
+static void setup_mutate(State *state, Rng *rng, Setup *setup, float mutation_rate) {
+	for (Platform *platform = setup->platforms, *end = platform + setup->nplatforms;
+		platform != end; ++platform) {
+		if (randf(rng) < mutation_rate)
+			platform_mutate(state, rng, setup, platform);
 	}
-	return 0;
 }
 
-static void setup_mutate(State *state, Setup *setup, float mutation_rate) {
-	for (Platform *platform = setup->platforms, *end = platform + setup->nplatforms;
-		platform != end; ++platform) {
-		if (randf() < mutation_rate)
-			platform_mutate(state, setup, platform);
+// the r'th best setup from the last generation (r < state->top_kept)
+static Setup *setup_top(State *state, u32 r) {
+	assert(r < state->top_kept);
+	return &state->setups[state->top[r]];
+}
+
+// is a better than b?
+static bool setup_key_better(SetupKey const *a, SetupKey const *b) {
+	if (a->score != b->score) return a->score > b->score;
+	return a->position < b->position;
+}
+
+static int setup_key_compare(void const *a_void, void const *b_void) {
+	SetupKey const *a = (SetupKey const *)a_void, *b = (SetupKey const *)b_void;
+	return setup_key_better(a, b) ? -1 : setup_key_better(b, a) ? +1 : 0;
+}
+
+// rearrange keys so that the best k of them are in keys[0..k), in no particular order (quickselect)
+static void setup_keys_select(SetupKey *keys, u32 n, u32 k) {
+	u32 lo = 0, hi = n; // the k'th best key is somewhere in [lo, hi)
+	while (hi - lo > 1) {
+		// median of three pivot
+		u32 mid = lo + (hi - lo) / 2;
+		SetupKey a = keys[lo], b = keys[mid], c = keys[hi - 1];
+		SetupKey pivot = setup_key_better(&a, &b)
+			? (setup_key_better(&b, &c) ? b : setup_key_better(&a, &c) ? c : a)
+			: (setup_key_better(&a, &c) ? a : setup_key_better(&b, &c) ? c : b);
+		// partition into [lo, i) better than the pivot, [i, j) the pivot, [j, hi) worse
+		// (keys are all different, because their positions are)
+		u32 i = lo, j = hi;
+		for (u32 p = lo; p < j; ) {
+			if (setup_key_better(&keys[p], &pivot)) {
+				SetupKey tmp = keys[p]; keys[p] = keys[i]; keys[i] = tmp;
+				++i; ++p;
+			} else if (setup_key_better(&pivot, &keys[p])) {
+				--j;
+				SetupKey tmp = keys[p]; keys[p] = keys[j]; keys[j] = tmp;
+			} else {
+				++p;
+			}
+		}
+		if (k < i) hi = i;
+		else if (k >= j) lo = j;
+		else break;
 	}
 }
 
-// sort setups to put best ones at the start
-static void setups_sort(State *state) {
-	qsort(state->setups, arr_count(state->setups), sizeof(Setup), setup_compare_scores);
+static bool pareto_select(State *state, SetupKey *keys, u32 n, u32 k);
+
+// the score setups are ranked by
+static float setup_rank_score(State const *state, Setup const *setup) {
+	return state->novelty ? setup->score + state->novelty_weight * setup->novelty : setup->score;
+}
+
+// rank the setups, and make the top_kept best ones the top setups (setups[0..top_kept)).
+// (with state->pareto, "best" is decided by pareto_select instead of just by score,
+// and with state->novelty, it's decided by setup_rank_score.)
+// this only sorts small keys, and the only setups which are copied are new ones which made it into the top.
+// ties are broken the same way a stable sort of the top setups (by rank) followed by the new ones would.
+static void setups_select_top(State *state) {
+	u32 n = state->nsetups, k = state->top_kept;
+	SetupKey *keys = state->setup_keys;
+	for (u32 r = 0; r < k; ++r) {
+		u32 index = state->top[r];
+		keys[r].score = setup_rank_score(state, &state->setups[index]);
+		keys[r].position = r;
+		keys[r].index = index;
+	}
+	for (u32 i = k; i < n; ++i) {
+		keys[i].score = setup_rank_score(state, &state->setups[i]);
+		keys[i].position = i;
+		keys[i].index = i;
+	}
+	if (!state->pareto || !pareto_select(state, keys, n, k)) {
+		setup_keys_select(keys, n, k);
+		qsort(keys, k, sizeof *keys, setup_key_compare);
+	}
+
+	// new setups in the top go where the top setups which aren't anymore were
+	bool *kept = state->top_slot_kept;
+	memset(kept, 0, k * sizeof *kept);
+	for (u32 r = 0; r < k; ++r)
+		if (keys[r].index < k)
+			kept[keys[r].index] = true;
+	u32 free_slot = 0;
+	for (u32 r = 0; r < k; ++r) {
+		u32 index = keys[r].index;
+		if (index >= k) {
+			u32 group = state->setups[index].group;
+			if (group) ++state->mutation_groups[group - 1].yield;
+			while (kept[free_slot]) ++free_slot;
+			state->setups[free_slot] = state->setups[index];
+			if (state->records)
+				setup_record_copy(&state->records[free_slot], &state->records[index], state->setups[index].nplatforms);
+			kept[free_slot] = true;
+			index = free_slot;
+		}
+		state->top[r] = index;
+	}
 }
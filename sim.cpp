@@ -1,9 +1,11 @@
 #include "gui.hpp"
+#if !HEADLESS
 #ifdef _WIN32
 #include <windows.h>
 #include "lib/glcorearb.h"
 #endif
 #include <GL/gl.h>
+#endif
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,16 +14,27 @@
 #include <assert.h>
 #include <ctype.h>
 
+#if !HEADLESS
 #define MATH_GL
+#endif
 #include "math.cpp"
+#include "thread.cpp"
 #include "sim.hpp"
 #include "time.cpp"
 #include "util.cpp"
 #include "base.cpp"
+#if !HEADLESS
 #include "text.cpp"
+#endif
 
 #define BALL_STARTING_X 3.0f
 #define BALL_STARTING_POS V2(BALL_STARTING_X, 10.0f)
+#define BALL_RADIUS 0.3f
+#define BALL_FRICTION 0.3f
+#define BALL_RESTITUTION 0.6f // bounciness
+#define PLATFORM_FRICTION 0.5f
+#define GRAVITY (-9.81f)
+#define TIME_STEP 0.01f // fixed time step
 
 static b2Vec2 v2_to_b2(v2 v) {
 	return b2Vec2(v.x, v.y);
@@ -42,94 +55,368 @@ static v2 pixels_to_gl_coords(State *state, u32 x, u32 y) {
 		(1 - (float)y / state->win_height) * 2 - 1);
 }
 
+#if !HEADLESS
 #include "shaders.cpp"
+#endif
 #include "platforms.cpp"
 
-static void simulate_time(State *state, float dt) {
-	Ball *ball = &state->ball;
+void PlatformContactListener::BeginContact(b2Contact *contact) {
+	++ntouching; // the ball is the only dynamic body, so it's in every contact
+	// platforms only collide with the ball, so if one of these is a platform, the ball touched it
+	uintptr_t userdata[2] = {contact->GetFixtureA()->GetUserData().pointer, contact->GetFixtureB()->GetUserData().pointer};
+	for (int i = 0; i < 2; ++i) {
+		if (userdata[i] & USER_DATA_PLATFORM) {
+			u32 index = (u32)(userdata[i] & ~USER_DATA_PLATFORM);
+			if (index < MAX_PLATFORMS) touched |= (u32)1 << index;
+		}
+	}
+}
+
+void PlatformContactListener::EndContact(b2Contact *contact) {
+	(void)contact;
+	--ntouching;
+}
+
+// start recording what happens to the ball
+static void sim_record_start(SimContext *sim) {
+	SetupRecord *record = &sim->record_current;
+	memset(record, 0, sizeof *record);
+	record->valid = true;
+	record->steps_per_box = 1;
+	record->checkpoint_every = 50;
+	sim->contact_listener->touched = 0;
+	sim->contact_listener->ntouching = 0;
+}
+
+// add the ball's position to the recorded path
+static void sim_record_ball(SimContext *sim, v2 pos) {
+	SetupRecord *record = &sim->record_current;
+	Rect point = rect(pos, V2(0, 0));
+	if (record->nboxes && record->steps_in_last_box < record->steps_per_box) {
+		Rect *box = &record->boxes[record->nboxes - 1];
+		*box = rect_union(*box, point);
+	} else {
+		if (record->nboxes == MAX_PATH_BOXES) {
+			// out of boxes; merge each pair of boxes into one
+			for (u32 i = 0; i < MAX_PATH_BOXES / 2; ++i)
+				record->boxes[i] = rect_union(record->boxes[2*i], record->boxes[2*i+1]);
+			record->nboxes = MAX_PATH_BOXES / 2;
+			record->steps_per_box *= 2;
+		}
+		record->boxes[record->nboxes++] = point;
+		record->steps_in_last_box = 0;
+	}
+	++record->steps_in_last_box;
+	++record->nsteps;
+}
+
+static BodyCheckpoint body_checkpoint(b2Body *body) {
+	BodyCheckpoint checkpoint;
+	checkpoint.pos = b2_to_v2(body->GetPosition());
+	checkpoint.velocity = b2_to_v2(body->GetLinearVelocity());
+	checkpoint.angle = body->GetAngle();
+	checkpoint.angular_velocity = body->GetAngularVelocity();
+	return checkpoint;
+}
+
+static void body_restore(b2Body *body, BodyCheckpoint const *checkpoint) {
+	body->SetTransform(v2_to_b2(checkpoint->pos), checkpoint->angle);
+	body->SetLinearVelocity(v2_to_b2(checkpoint->velocity));
+	body->SetAngularVelocity(checkpoint->angular_velocity);
+}
+
+// called at the end of each time step. dt_left is the time simulate_time has left to simulate.
+static void sim_record_checkpoint(SimContext *sim, float dt_left) {
+	SetupRecord *record = &sim->record_current;
+	if (sim->contact_listener->ntouching > 0) return; // we can't save Box2D's contacts
+	u32 last_step = record->ncheckpoints ? record->checkpoints[record->ncheckpoints - 1].step : 0;
+	if (record->nsteps < last_step + record->checkpoint_every) return;
+	if (record->ncheckpoints == MAX_CHECKPOINTS) {
+		// out of room; throw away every other checkpoint
+		for (u32 i = 0; i < MAX_CHECKPOINTS / 2; ++i)
+			record->checkpoints[i] = record->checkpoints[2*i+1];
+		record->ncheckpoints = MAX_CHECKPOINTS / 2;
+		record->checkpoint_every *= 2;
+	}
+	SimCheckpoint *checkpoint = &record->checkpoints[record->ncheckpoints++];
+	checkpoint->step = record->nsteps;
+	checkpoint->touched = sim->contact_listener->touched;
+	checkpoint->stuck_time = sim->stuck_time;
+	checkpoint->total_time = sim->total_time;
+	checkpoint->furthest_ball_x_pos = sim->furthest_ball_x_pos;
+	checkpoint->dt_left = dt_left;
+	checkpoint->ball = body_checkpoint(sim->ball.body);
+	for (u32 i = 0; i < sim->nplatforms; ++i)
+		checkpoint->platforms[i] = body_checkpoint(sim->platforms[i].body);
+}
+
+// carry on recording from checkpoints[c] of record (which was recorded for a setup which behaves the same
+// as the one being simulated, up to that checkpoint), and put the simulation in the state it was in then.
+// setup_use should have already been called.
+static void sim_record_resume(SimContext *sim, SetupRecord const *record, u32 c) {
+	SetupRecord *current = &sim->record_current;
+	SimCheckpoint const *checkpoint = &record->checkpoints[c];
+	*current = *record;
+	// only keep the checkpoint we're starting from (the ones before it have the wrong positions for mutated platforms,
+	// and this one's are fixed below)
+	current->checkpoints[0] = *checkpoint;
+	current->ncheckpoints = 1;
+	current->resume_replay = 0;
+	current->nsteps = checkpoint->step;
+	current->touched = checkpoint->touched;
+	// throw away the boxes after the one the next step goes in.
+	// (the last one might still include some of the old path, which is fine, since it's only ever used
+	// to check whether the ball went near something.)
+	u32 full_boxes = checkpoint->step / record->steps_per_box, partial = checkpoint->step % record->steps_per_box;
+	if (partial) {
+		current->nboxes = full_boxes + 1;
+		current->steps_in_last_box = partial;
+	} else {
+		current->nboxes = full_boxes;
+		current->steps_in_last_box = record->steps_per_box;
+	}
+	sim->contact_listener->touched = checkpoint->touched;
+	sim->contact_listener->ntouching = 0;
+
+	Ball *ball = &sim->ball;
+	body_restore(ball->body, &checkpoint->ball);
+	ball->pos = checkpoint->ball.pos;
+	for (u32 i = 0; i < sim->nplatforms; ++i) {
+		Platform *platform = &sim->platforms[i];
+		// the checkpoint has where the parent's version of a mutated platform was, so work out where it is now
+		// (the first position is recorded before any steps are taken)
+		BodyCheckpoint body = record->resume_replay & ((u32)1 << i)
+			? platform_replay(platform, checkpoint->step - 1, TIME_STEP)
+			: checkpoint->platforms[i];
+		body_restore(platform->body, &body);
+		platform->center = body.pos;
+		platform->angle = body.angle;
+		current->checkpoints[0].platforms[i] = body;
+	}
+	sim->stuck_time = checkpoint->stuck_time;
+	sim->total_time = checkpoint->total_time;
+	sim->furthest_ball_x_pos = checkpoint->furthest_ball_x_pos;
+	sim->time_residue = checkpoint->dt_left;
+}
+
+// take the ball out of the world (or put its body in the pool)
+static void ball_remove_body(SimContext *sim) {
+	Ball *ball = &sim->ball;
+	b2Body *body = ball->body;
+	if (!body) return;
+	if (sim->pool_bodies && !sim->ball_body_pool) {
+		body->SetEnabled(false);
+		sim->ball_body_pool = body;
+	} else {
+		sim->world->DestroyBody(body);
+	}
+	ball->body = NULL;
+}
+
+// if the ball is in free flight to the right of every platform (and going right), it can't touch anything again,
+// so we can work out where it lands without stepping the world any more.
+// this follows the same (semi-implicit Euler) steps Box2D takes, so it agrees with the full simulation
+// up to rounding error. returns true if the simulation is over.
+static bool simulate_ballistic_exit(SimContext *sim, float time_step) {
+	Ball *ball = &sim->ball;
+	b2Vec2 vel = ball->body->GetLinearVelocity();
+	if (vel.x < 0.01f) return false; // it might come back, or get "stuck" before it lands
+	if (ball->pos.x - ball->radius <= sim->platforms_right_x) return false;
+	double h = time_step, g = sim->world->GetGravity().y;
+	if (g >= 0) return false;
+	double vx = vel.x, vy = vel.y;
+	double height = ball->pos.y - ball->radius - sim->bottom_y; // how far above the bottom line the ball is
+	// after j more steps, the ball's height is height + h*vy*j + a*j*(j+1)
+	double a = 0.5 * g * h * h;
+	double b = h * vy + a;
+	double j_land = (-b - sqrt(b * b - 4 * a * height)) / (2 * a);
+	u64 n = (u64)j_land + 1; // number of steps until the ball reaches the bottom (j_land >= 0, since height >= 0)
+	// fix any rounding errors
+	while (n > 1 && height + b * (double)(n-1) + a * (double)(n-1) * (double)(n-1) < 0) --n;
+	while (height + b * (double)n + a * (double)n * (double)n >= 0) ++n;
+	// Box2D limits how far a body can move in one step, which would make this wrong
+	double landing_vy = vy + g * h * (double)n;
+	if ((vx * vx + landing_vy * landing_vy) * h * h > b2_maxTranslation * b2_maxTranslation)
+		return false;
+
+	ball_remove_body(sim);
+	// (like in simulate_time, the ball's x position isn't updated on the step it reaches the bottom)
+	ball->pos.x = (float)(ball->pos.x + (double)(n-1) * h * vx);
+	ball->pos.y = sim->bottom_y + ball->radius;
+	sim->furthest_ball_x_pos = ball->pos.x;
+	sim->stuck_time = 0;
+	sim->total_time += (float)((double)n * h);
+	sim->ballistic_exited = true;
+	return true;
+}
+
+/*
+Branch and bound: if the ball can't end up further right than the worst of the top setups,
+there's no point simulating it any more.
+Let E be the ball's energy (per unit mass, with height measured from where it lands).
+Box2D's contacts with static bodies (and its friction) can only take energy away, so if the ball
+can't get high enough to touch a moving or rotating platform, its energy will never be more than E.
+After the last time the ball touches a platform, it's at most sim->platforms_right_x + its radius,
+and a projectile with energy E can travel at most v*sqrt(v^2 + 2gh)/g <= (v^2 + 2gh)/g <= 2E/g
+horizontally before it lands, so it can't end up further than max(x, platforms_right_x + radius) + 2E/g.
+*/
+#define PRUNE_MARGIN 0.5f // leave some room for Box2D's position correction and rounding errors
+
+// returns true if the simulation was stopped
+static bool simulate_prune(SimContext *sim) {
+	Ball *ball = &sim->ball;
+	b2Body *body = ball->body;
+	double g = -sim->world->GetGravity().y;
+	if (g <= 0) return false;
+	b2Vec2 v = body->GetLinearVelocity();
+	double w = body->GetAngularVelocity(), r = ball->radius;
+	double height = ball->pos.y - (sim->bottom_y + r);
+	// (the ball is a disk, so its rotational energy is r^2 w^2 / 4 per unit mass. friction can turn that into speed.)
+	double energy = 0.5 * ((double)v.x * v.x + (double)v.y * v.y) + 0.25 * r * r * w * w + g * height;
+	double max_y = sim->bottom_y + r + energy / g; // highest the ball can go
+	if (max_y + r + PRUNE_MARGIN >= sim->kinematic_bottom_y)
+		return false; // a moving or rotating platform could give it more energy
+	double x = ball->pos.x;
+	double reach_from = sim->platforms_right_x + r;
+	if (reach_from < x) reach_from = x;
+	double max_x = reach_from + 2 * energy / g + PRUNE_MARGIN;
+	if (max_x >= sim->prune_x)
+		return false;
+	ball_remove_body(sim);
+	ball->pos.x = (float)max_x; // so that the score is an upper bound
+	sim->pruned = true;
+	return true;
+}
+
+// (see trajectory.cpp)
+static void trajectory_start(Trajectory *trajectory, SimContext const *sim);
+static void trajectory_add_frame(SimContext *sim);
+
+static void simulate_time(SimContext *sim, float dt) {
+	Ball *ball = &sim->ball;
 	if (!ball->body) return; // we're done simulating
-	float time_step = 0.01f; // fixed time step
-	dt += state->time_residue;
+	float time_step = TIME_STEP;
+	dt += sim->time_residue;
 	while (dt >= time_step) {
-		b2World *world = state->world;
+		b2World *world = sim->world;
 
 		world->Step(time_step, 8, 3); // step using recommended parameters
+		++sim->nsteps;
 
 		{ // update ball
-			state->stuck_time += time_step;
-			state->total_time += time_step;
+			sim->stuck_time += time_step;
+			sim->total_time += time_step;
 			b2Vec2 ball_pos = ball->body->GetPosition();
 
 			assert(!(isnan(ball_pos.x) || isnan(ball_pos.y))); // there used to be a problem with NaN but it should be fixed now
+			if (sim->record) sim_record_ball(sim, b2_to_v2(ball_pos));
 
-			bool reached_bottom = ball_pos.y - ball->radius < state->bottom_y; // ball reached bottom line
+			bool reached_bottom = ball_pos.y - ball->radius < sim->bottom_y; // ball reached bottom line
 			float max_stuck_time = 10;
-			bool stuck = state->stuck_time > max_stuck_time; // ball hasn't gotten any further in a while. it's over
+			bool stuck = sim->stuck_time > max_stuck_time; // ball hasn't gotten any further in a while. it's over
 			if (reached_bottom || stuck) {
-				world->DestroyBody(ball->body);
-				ball->body = NULL;
+				ball_remove_body(sim);
 				if (reached_bottom) {
 					// place ball on ground
-					ball->pos.y = state->bottom_y + ball->radius;
+					ball->pos.y = sim->bottom_y + ball->radius;
 				}
 				if (stuck)
-					state->stuck_time = max_stuck_time;
+					sim->stuck_time = max_stuck_time;
 				return; // done simulating
 			} else {
 				ball->pos = b2_to_v2(ball_pos);
 				float rounded_pos = 0.01f * roundf(ball->pos.x * 100);
-				float rounded_record = 0.01f * roundf(state->furthest_ball_x_pos * 100);
+				float rounded_record = 0.01f * roundf(sim->furthest_ball_x_pos * 100);
 				if (rounded_pos > rounded_record) { // only update record if centimeter reading will change
-					state->furthest_ball_x_pos = ball->pos.x;
-					state->stuck_time = 0;
+					sim->furthest_ball_x_pos = ball->pos.x;
+					sim->stuck_time = 0;
 				}
 			}
 		}
 
-		for (Platform *platform = state->platforms, *end = platform + state->nplatforms; platform != end; ++platform) {
+		for (Platform *platform = sim->platforms, *end = platform + sim->nplatforms; platform != end; ++platform) {
 			platform->angle = platform->body->GetAngle();
 			v2 pos = b2_to_v2(platform->body->GetPosition());
 			platform->center = pos;
 
 			if (platform->moves) {
 				// check if the platform has reached the other endpoint; if so, set it going in the other direction
-				v2 p1 = platform->move_p1, p2 = platform->move_p2;
 				v2 vel = b2_to_v2(platform->body->GetLinearVelocity());
-				bool switch_direction = false;
-
-				if (vel.x > 0) {
-					if (pos.x > maxf(p1.x, p2.x))
-						switch_direction = true;
-				} else if (vel.x < 0) {
-					if (pos.x < minf(p1.x, p2.x))
-						switch_direction = true;
-				}
-				if (vel.y > 0) {
-					if (pos.y > maxf(p1.y, p2.y))
-						switch_direction = true;
-				} else if (vel.y < 0) {
-					if (pos.y < minf(p1.y, p2.y))
-						switch_direction = true;
-				}
-
-				if (switch_direction) {
+				if (platform_turns_around(platform, pos, vel)) {
 					v2 new_vel = v2_scale(vel, -1); // flip the velocity
 					platform->body->SetLinearVelocity(v2_to_b2(new_vel));
 				}
-				
 			}
 		}
+		if (sim->trajectory) trajectory_add_frame(sim);
 
+		if (sim->ballistic_exit && simulate_ballistic_exit(sim, time_step))
+			return; // done simulating
+		if (sim->prune && simulate_prune(sim))
+			return; // done simulating
 
 		dt -= time_step;
+		if (sim->record) sim_record_checkpoint(sim, dt);
 	}
-	state->time_residue = dt;
+	sim->time_residue = dt;
+}
+
+// create a Box2D world with the ground and the left wall in it
+static void world_create(SimContext *sim) {
+	b2Vec2 gravity(0, GRAVITY);
+	b2World *world = sim->world = new b2World(gravity);
+	world->SetContactListener(sim->contact_listener);
+		
+	// create ground
+	b2BodyDef ground_body_def;
+	ground_body_def.position.Set(0.0f, -1000.0f);
+	b2Body *ground_body = world->CreateBody(&ground_body_def);
+
+	b2PolygonShape ground_shape;
+	ground_shape.SetAsBox(50.0f, 10.0f);
+	ground_body->CreateFixture(&ground_shape, 0.0f);
+
+	// create left wall
+	b2BodyDef left_wall_def;
+	left_wall_def.position.Set(sim->left_x - 0.5f, 0);
+	b2Body *left_wall_body = world->CreateBody(&left_wall_def);
+	b2PolygonShape left_wall_shape;
+	left_wall_shape.SetAsBox(0.5f, 1000);
+	left_wall_body->CreateFixture(&left_wall_shape, 0);
 }
 
+// destroy the world, along with all the bodies in it
+static void world_destroy(SimContext *sim) {
+	delete sim->world;
+	sim->world = NULL;
+	sim->ball.body = NULL;
+	for (u32 i = 0; i < sim->nplatforms; ++i)
+		sim->platforms[i].body = NULL;
+	sim->ball_body_pool = NULL;
+	sim->nplatform_body_pool = 0;
+}
+
+// sets up a context for simulating (and scoring) setups
+static void sim_init(SimContext *sim) {
+	sim->platform_thickness = 0.05f;
+	sim->bottom_y = 0.1f;
+	sim->left_x   = 0;
+	sim->contact_listener = new PlatformContactListener();
+	world_create(sim);
+}
+
+static void sim_free(SimContext *sim) {
+	delete sim->world;
+	delete sim->contact_listener;
+	sim->world = NULL;
+	sim->contact_listener = NULL;
+}
+
+#if !HEADLESS
 // render the ball
 static void ball_render(State *state) {
 	GL *gl = &state->gl;
-	Ball *ball = &state->ball;
+	Ball *ball = &state->sim.ball;
 	float ball_x = ball->pos.x, ball_y = ball->pos.y;
 	float ball_r = ball->radius;
 	ShaderBall *shader = &state->shader_ball;
@@ -149,8 +436,19 @@ static void ball_render(State *state) {
 	glEnd();
 	shader_stop_using(gl);
 }
+#endif
 
 #include "setup.cpp"
+#include "scoring.cpp"
+#include "surrogate.cpp"
+#include "incremental.cpp"
+#include "cache.cpp"
+#include "pareto.cpp"
+#include "novelty.cpp"
+#include "writer.cpp"
+#include "population.cpp"
+#include "history.cpp"
+#include "trajectory.cpp"
 
 static void correct_mouse_button(State *state, u8 *button) {
 	if (*button == MOUSE_LEFT) {
@@ -164,58 +462,317 @@ static void correct_mouse_button(State *state, u8 *button) {
 	}
 }
 
-static void start_evolution(State *state) {
-	for (size_t i = 0; i < arr_count(state->setups); ++i) {
+// random number generator for making the index'th new setup of the given generation.
+// every setup gets its own stream, so the setups don't depend on the order they're made in (or which thread makes them).
+static Rng setup_rng(State const *state, u64 generation, u32 index) {
+	return rng_derive(state->seed, generation, index);
+}
+#define INITIAL_GENERATION U64_MAX // "generation" for the setups made by start_evolution
+
+// the default population size and mutation groups
+static void evolution_settings_default(State *state) {
+	state->generation_size = DEFAULT_GENERATION_SIZE;
+	state->top_kept = DEFAULT_TOP_KEPT;
+	static float const mutation_rates[] = {
+		0.05f, // 5% mutation rate group
+		0.10f, // 10% mutation rate group
+		0.20f, // 20% mutation rate group
+		0.30f, // 30% mutation rate group
+		MUTATION_RANDOM, // completely random group
+	};
+	state->nmutation_groups = arr_count(mutation_rates);
+	for (u32 g = 0; g < state->nmutation_groups; ++g) {
+		MutationGroup *group = &state->mutation_groups[g];
+		memset(group, 0, sizeof *group);
+		group->weight = 1;
+		group->mutation_rate = mutation_rates[g];
+	}
+}
+
+/*
+With state->adaptive_groups, the new setups are split between the mutation groups like a multi-armed bandit:
+each group's share is proportional to its weight times how often its setups have made it into the top
+(counting recent generations more, since which mutation rates work best changes as the setups get better).
+Every group always gets some of them, so we notice if a group starts doing well again.
+Otherwise, they're just split by weight.
+The split for each generation only depends on the generations before it, so it doesn't depend on the number of threads.
+*/
+#define GROUP_DISCOUNT 0.8 // how much each generation's results count for compared to the next one's
+#define GROUP_MIN_SHARE 0.2 // this fraction of the new setups is always split by weight alone
+#define GROUP_PRIOR_TRIALS 10.0 // a group's yield starts out as the average yield of all the groups over this many setups
+
+// work out how many new setups each mutation group gets this generation
+static void mutation_groups_allocate(State *state) {
+	u32 ngroups = state->nmutation_groups;
+	MutationGroup *groups = state->mutation_groups;
+	u64 total_weight = 0;
+	double total_trials = 0, total_wins = 0;
+	for (u32 g = 0; g < ngroups; ++g) {
+		total_weight += groups[g].weight;
+		total_trials += groups[g].trials;
+		total_wins += groups[g].wins;
+		groups[g].yield = 0;
+	}
+	if (!state->adaptive_groups || total_wins == 0) {
+		// group g gets new setups [generation_size * (weights before g) / total_weight, generation_size * (weights up to g) / total_weight)
+		u64 weight = 0, end = 0;
+		for (u32 g = 0; g < ngroups; ++g) {
+			weight += groups[g].weight;
+			u64 next_end = state->generation_size * weight / total_weight;
+			groups[g].nsetups = (u32)(next_end - end);
+			end = next_end;
+		}
+		return;
+	}
+	double prior_rate = total_wins / total_trials;
+	double share[MAX_MUTATION_GROUPS], total_share = 0;
+	for (u32 g = 0; g < ngroups; ++g) {
+		double rate = (groups[g].wins + prior_rate * GROUP_PRIOR_TRIALS) / (groups[g].trials + GROUP_PRIOR_TRIALS);
+		share[g] = groups[g].weight * rate;
+		total_share += share[g];
+	}
+	// round the cumulative shares, so that the counts add up to generation_size
+	double cumulative = 0;
+	u32 end = 0;
+	for (u32 g = 0; g < ngroups; ++g) {
+		cumulative += GROUP_MIN_SHARE * (double)groups[g].weight / (double)total_weight
+			+ (1 - GROUP_MIN_SHARE) * share[g] / total_share;
+		u32 next_end = g == ngroups - 1 ? state->generation_size : (u32)(cumulative * state->generation_size + 0.5);
+		if (next_end < end) next_end = end;
+		if (next_end > state->generation_size) next_end = state->generation_size;
+		groups[g].nsetups = next_end - end;
+		end = next_end;
+	}
+}
+
+// count how many of this generation's setups from each group made it into the top (after setups_select_top)
+static void mutation_groups_update(State *state) {
+	for (u32 g = 0; g < state->nmutation_groups; ++g) {
+		MutationGroup *group = &state->mutation_groups[g];
+		group->trials = GROUP_DISCOUNT * group->trials + group->nsetups;
+		group->wins = GROUP_DISCOUNT * group->wins + group->yield;
+	}
+}
+
+// which mutation group the i'th new setup of this generation is in
+static u32 mutation_group(State const *state, u32 i) {
+	u32 end = 0;
+	for (u32 g = 0; g < state->nmutation_groups; ++g) {
+		end += state->mutation_groups[g].nsetups;
+		if (i < end) return g;
+	}
+	return state->nmutation_groups - 1;
+}
+
+static void evolution_free(State *state) {
+	free(state->setups);
+	free(state->records);
+	free(state->top);
+	free(state->setup_keys);
+	free(state->top_slot_kept);
+	state->setups = NULL;
+	state->records = NULL;
+	state->top = NULL;
+	state->setup_keys = NULL;
+	state->top_slot_kept = NULL;
+	state->nsetups = 0;
+	free(state->pareto_archive);
+	state->pareto_archive = NULL;
+	state->npareto_archive = 0;
+	novelty_archive_free(&state->novelty_archive);
+}
+
+// allocate the setups for state->generation_size and top_kept. returns false if there isn't enough memory.
+static bool evolution_alloc(State *state) {
+	assert(state->top_kept >= 1 && state->generation_size >= 1 && state->nmutation_groups >= 1);
+	evolution_free(state);
+	state->nsetups = state->top_kept + state->generation_size;
+	state->setups = calloc_arr(Setup, state->nsetups);
+	state->top = calloc_arr(u32, state->top_kept);
+	state->setup_keys = calloc_arr(SetupKey, state->nsetups);
+	state->top_slot_kept = calloc_arr(bool, state->top_kept);
+	bool records = state->incremental || state->checkpoints;
+	if (records) state->records = calloc_arr(SetupRecord, state->nsetups);
+	if (!state->setups || !state->top || !state->setup_keys || !state->top_slot_kept || (records && !state->records)) {
+		evolution_free(state);
+		return false;
+	}
+	for (u32 r = 0; r < state->top_kept; ++r)
+		state->top[r] = r;
+	return true;
+}
+
+// make the initial (random) setups. they still need to be scored with score_initial_setups.
+// state->generation_size, top_kept and the mutation groups need to be set before this is called.
+// returns false if there isn't enough memory for the setups.
+static bool make_initial_setups(State *state) {
+	if (!evolution_alloc(state))
+		return false;
+	for (u32 g = 0; g < state->nmutation_groups; ++g) {
+		MutationGroup *group = &state->mutation_groups[g];
+		group->nsetups = group->yield = 0;
+		group->trials = group->wins = 0;
+	}
+	for (u32 i = 0; i < state->nsetups; ++i) {
 		// randomize initial setups
 		Setup *setup = &state->setups[i];
-		setup_random(state, setup);
-		setup_score(state, setup);
+		Rng rng = setup_rng(state, INITIAL_GENERATION, i);
+		setup_random(state, &rng, setup);
 	}
-	setups_sort(state);
+	return true;
+}
+
+// score the setups made by make_initial_setups, and select the first top setups
+static void score_initial_setups(State *state) {
+	setups_score_parallel(state, state->setups, state->records, NULL, state->nsetups);
+	fitness_cache_clear(state);
+	if (state->fitness_cache_enabled) {
+		for (u32 i = 0; i < state->nsetups; ++i)
+			fitness_cache_put(state, fitness_hash(state, &state->setups[i]), &state->setups[i]);
+	}
+	if (state->novelty) novelty_update(state, 0);
+	setups_select_top(state);
+}
+
+// state->generation_size, top_kept and the mutation groups need to be set before this is called.
+// returns false if there isn't enough memory for the setups.
+static bool start_evolution(State *state) {
+	if (!make_initial_setups(state))
+		return false;
+	score_initial_setups(state);
 	state->evolve_menu = true;
+	return true;
 }
 
 // make sure you call start_evolution before you call this function for the first time
 static void start_generation(State *state) {
 	state->scoring_next = 0;
-	state->evolving = true;
 }
 
 static void finish_generation(State *state) {
-	setups_sort(state);
-	for (size_t i = 0; i < TOP_KEPT; ++i) {
-		Setup *setup = &state->setups[i];
-		char filename[64] = {0};
-		snprintf(filename, sizeof filename - 1, "setups/%03zu.b2s", i);
+	if (state->novelty) novelty_update(state, state->top_kept);
+	setups_select_top(state);
+	mutation_groups_update(state);
+	if (state->pareto) pareto_archive_update(state);
+	for (size_t i = 0; state->write_b2s && i < state->top_kept; ++i) {
+		Setup *setup = setup_top(state, (u32)i);
+		char filename[512] = {0};
+		snprintf(filename, sizeof filename - 1, "%s/%03zu.b2s", state->output_dir, i);
 	#if 0
 		printf("%zu. %f - mutated %llu times\n", 
 			i, setup->score, (ullong)setup->mutations);
 	#endif
-		setup_write_to_file(setup, filename);
+		// (on the writer thread, like top.b2p, so that we don't wait for the disk here)
+		size_t size = 0;
+		u8 *data = setup_write_to_memory(setup, &size);
+		if (data) writer_submit(&state->writer, filename, NULL, data, size);
 	}
 	
 	++state->generation;
+	population_write(state);
+	if (state->history.data_fp) history_record(state);
 }
 
-// returns true if this is the last one in the generation
-static bool score_one(State *state) {
-	u32 i = state->scoring_next++;
-	// create new generation from TOP_KEPT
-	Setup *setup = &state->setups[i + TOP_KEPT];
-	*setup = state->setups[rand() % TOP_KEPT]; // select one of the top setups to mutate from
+// create the i'th new setup of this generation from the top setups of the last one
+static void setup_make_child(State *state, u32 i) {
+	Setup *setup = &state->setups[i + state->top_kept];
+	Rng rng = setup_rng(state, state->generation, i);
+	u32 parent_index = state->top[rand_u32(&rng) % state->top_kept]; // select one of the top setups to mutate from
+	Setup const *parent = &state->setups[parent_index];
+	SetupRecord *record = state->records ? &state->records[i + state->top_kept] : NULL;
+	SetupRecord const *parent_record = state->records ? &state->records[parent_index] : NULL;
+	*setup = *parent;
+	setup->nsteps = 0; // (stays 0 if it isn't simulated)
+	setup->pruned = false;
 	++setup->mutations;
-	switch (i / 20) {
-	case 0: setup_mutate(state, setup, 0.05f); break; // 5% mutation rate group
-	case 1: setup_mutate(state, setup, 0.10f); break; // 10% mutation rate group
-	case 2: setup_mutate(state, setup, 0.20f); break; // 20% mutation rate group
-	case 3: setup_mutate(state, setup, 0.30f); break; // 30% mutation rate group
-	case 4: // completely random group
-		memset(setup, 0, sizeof *setup);
-		setup_random(state, setup);
-		break;
-	}
-	setup_score(state, setup);
-	if (state->scoring_next >= GENERATION_SIZE) {
+	u32 group = mutation_group(state, i);
+	float mutation_rate = state->mutation_groups[group].mutation_rate;
+	if (mutation_rate == MUTATION_RANDOM) {
+		setup->score = setup->total_time = 0;
+		setup->mutations = 0;
+		setup->nplatforms = 0;
+		setup_random(state, &rng, setup);
+	} else {
+		setup_mutate(state, &rng, setup, mutation_rate);
+	}
+	setup->group = group + 1;
+	if (!record) return;
+	// (the parent's record is only copied if it's needed)
+	setup_record_clear(record);
+	if (state->incremental && incremental_can_reuse(state, parent, parent_record, setup)) {
+		setup->score = parent->score;
+		setup->total_time = parent->total_time;
+		setup_record_copy(record, parent_record, parent->nplatforms);
+		record->reused = true;
+		// the checkpoints were taken with the parent's platforms
+		record->resume_replay = parent_record->resume_replay | setups_changed_platforms(parent, setup);
+	} else {
+		u32 replay = 0;
+		u32 resume = state->checkpoints ? incremental_resume_checkpoint(state, parent, parent_record, setup, &replay) : 0;
+		if (resume) setup_record_copy(record, parent_record, parent->nplatforms);
+		record->reused = false;
+		record->resume_checkpoint = resume;
+		record->resume_replay = replay;
+	}
+}
+
+// add new setups which were just scored to state->prune_stats.
+// with state->prune_check, also simulate the pruned ones without pruning, to see how much time it saved
+// and whether any of them would have made it into the top.
+static void prune_check(State *state, Setup const *setups, u32 nsetups) {
+	PruneStats *stats = &state->prune_stats;
+	u32 npruned = 0;
+	for (u32 i = 0; i < nsetups; ++i) {
+		if (!setups[i].nsteps) continue; // not simulated
+		++stats->nsetups;
+		stats->nsteps += setups[i].nsteps;
+		if (setups[i].pruned) stats->nsteps_pruned += setups[i].nsteps;
+		npruned += setups[i].pruned;
+	}
+	stats->npruned += npruned;
+	if (!state->prune_check || !npruned) return;
+
+	Setup *full = calloc_arr(Setup, npruned);
+	u32 *full_indices = calloc_arr(u32, npruned);
+	if (!full || !full_indices) {
+		free(full); free(full_indices);
+		return;
+	}
+	u32 n = 0;
+	for (u32 i = 0; i < nsetups; ++i) {
+		if (setups[i].nsteps && setups[i].pruned) {
+			full_indices[n] = i;
+			full[n++] = setups[i];
+		}
+	}
+	setups_score_parallel(state, full, NULL, NULL, n); // (state->pruning isn't set)
+	float top_score = setup_top(state, state->top_kept - 1)->score;
+	for (u32 f = 0; f < n; ++f) {
+		Setup const *pruned = &setups[full_indices[f]];
+		++stats->nchecked;
+		stats->nsteps_checked += full[f].nsteps;
+		if (full[f].nsteps > pruned->nsteps) stats->nsteps_saved += full[f].nsteps - pruned->nsteps;
+		if (full[f].score > top_score) ++stats->nwrong;
+	}
+	free(full); free(full_indices);
+}
+
+// score the next count setups of this generation (or all of the rest of them, if there are fewer than that),
+// using state->nthreads threads. returns true if this finished the generation.
+// the results don't depend on how the generation is split up into calls to this.
+static bool score_setups(State *state, u32 count) {
+	u32 first = state->scoring_next;
+	if (first == 0) mutation_groups_allocate(state);
+	if (count > state->generation_size - first) count = state->generation_size - first;
+	for (u32 i = first; i < first + count; ++i)
+		setup_make_child(state, i);
+	Setup *setups = &state->setups[state->top_kept + first];
+	state->pruning = state->prune;
+	setups_score_cached(state, setups, state->records ? &state->records[state->top_kept + first] : NULL, count);
+	state->pruning = false;
+	if (state->prune) prune_check(state, setups, count);
+	state->scoring_next += count;
+	if (state->scoring_next >= state->generation_size) {
 		finish_generation(state);
 		state->scoring_next = 0;
 		return true;
@@ -223,6 +780,128 @@ static bool score_one(State *state) {
 	return false;
 }
 
+// score the rest of this generation at once
+static void score_generation(State *state) {
+	score_setups(state, state->generation_size);
+}
+
+#include "run.cpp"
+
+#if !HEADLESS
+#define SNAPSHOT_NEW 0x100
+
+static void scoring_snapshot_publish(State *state) {
+	ScoringSnapshot *snapshot = &state->snapshots[state->snapshot_back];
+	snapshot->generation = state->generation;
+	snapshot->scoring_next = state->scoring_next;
+	snapshot->ntop = state->top_kept < SNAPSHOT_TOP ? state->top_kept : SNAPSHOT_TOP;
+	for (u32 r = 0; r < snapshot->ntop; ++r)
+		snapshot->top[r] = *setup_top(state, r);
+	state->snapshot_back = atomic_exchange_i32(&state->snapshot_middle, state->snapshot_back | SNAPSHOT_NEW) & ~SNAPSHOT_NEW;
+}
+
+// the latest snapshot published by the scoring thread
+static ScoringSnapshot const *scoring_snapshot_get(State *state) {
+	if (atomic_load_i32(&state->snapshot_middle) & SNAPSHOT_NEW)
+		state->snapshot_front = atomic_exchange_i32(&state->snapshot_middle, state->snapshot_front) & ~SNAPSHOT_NEW;
+	return &state->snapshots[state->snapshot_front];
+}
+
+// do whatever scoring_command says. returns false if there's nothing to do.
+static bool scoring_step(State *state) {
+	i32 command = atomic_load_i32(&state->scoring_command);
+	if (command == SCORING_STOP) return false;
+	// score a few setups per thread at a time, so that we can stop quickly and show progress
+	u32 count = 4 * (state->nthreads ? state->nthreads : 1);
+	if (score_setups(state, count) && command == SCORING_ONE_GENERATION)
+		atomic_cas_i32(&state->scoring_command, SCORING_ONE_GENERATION, SCORING_STOP);
+	scoring_snapshot_publish(state);
+	return true;
+}
+
+static void scoring_thread_run(void *state_void) {
+	State *state = (State *)state_void;
+	score_initial_setups(state);
+	scoring_snapshot_publish(state);
+	while (!atomic_load_i32(&state->scoring_quit)) {
+		if (!scoring_step(state))
+			time_sleep_ms(10);
+	}
+}
+
+// start scoring setups in the background, starting with the ones made by make_initial_setups.
+// after this, only the scoring thread should touch state->setups, state->generation, etc.;
+// the GUI should use scoring_snapshot_get (which has no top setups until the initial ones have been scored).
+static void scoring_thread_start(State *state) {
+	memset(state->snapshots, 0, sizeof state->snapshots);
+	state->snapshot_back = 0;
+	state->snapshot_middle = 1;
+	state->snapshot_front = 2;
+	state->scoring_command = SCORING_STOP;
+	state->scoring_quit = 0;
+	writer_start(&state->writer);
+	state->scoring_thread_running = thread_create(&state->scoring_thread, scoring_thread_run, state);
+	if (!state->scoring_thread_running) {
+		logln("Couldn't create scoring thread. Setups will be scored on the main thread.");
+		score_initial_setups(state);
+		scoring_snapshot_publish(state);
+	}
+}
+
+// stop the scoring thread, and finish writing any files it's saved
+static void scoring_thread_stop(State *state) {
+	if (state->scoring_thread_running) {
+		atomic_store_i32(&state->scoring_quit, 1);
+		thread_join(state->scoring_thread);
+		state->scoring_thread_running = false;
+	}
+	writer_stop(&state->writer);
+}
+
+// show a setup from the evolve menu. what happens to it is recorded first (which is much faster than
+// simulating it in real time), and then played back, so that it can be rewound and fast-forwarded.
+static void setup_view(State *state, Setup const *setup) {
+	SimContext *sim = &state->sim;
+	Setup *copy = calloc_object(Setup);
+	state->playing = false;
+	if (copy) {
+		*copy = *setup;
+		state->playing = trajectory_record(sim, copy, &state->trajectory)
+			&& trajectory_apply(&state->trajectory, 0, sim);
+		free(copy);
+	}
+	if (!state->playing) {
+		// just simulate it as we go
+		setup_use(sim, setup);
+	}
+	state->playback_time = 0;
+	state->evolve_menu = false;
+	atomic_store_i32(&state->scoring_command, SCORING_STOP);
+	state->simulating = true;
+}
+
+// play back a .b2t file (made with boxcatapult2d-headless -record) from the evolve menu.
+// returns false if it couldn't be loaded.
+static bool recording_view(State *state, char const *filename) {
+	SimContext *sim = &state->sim;
+	Setup *setup = calloc_object(Setup);
+	trajectory_free(&state->trajectory);
+	bool ok = setup && trajectory_load(&state->trajectory, setup, filename);
+	if (ok) {
+		setup_use(sim, setup);
+		ok = trajectory_apply(&state->trajectory, 0, sim);
+	}
+	free(setup);
+	if (!ok) return false;
+	state->playing = true;
+	state->playback_time = 0;
+	state->evolve_menu = false;
+	atomic_store_i32(&state->scoring_command, SCORING_STOP);
+	state->simulating = true;
+	return true;
+}
+
+// note: the scoring thread runs code from this file, so AUTO_RELOAD_CODE can't be used while evolving.
 #ifdef __cplusplus
 extern "C"
 #endif
@@ -242,10 +921,13 @@ void sim_frame(Frame *frame) {
 	State *state = (State *)frame->memory;
 #if DEBUG
 	if (state->magic_number != MAGIC_NUMBER || keys_pressed[KEY_F5]) {
+		if (state->magic_number == MAGIC_NUMBER)
+			scoring_thread_stop(state); // don't reset the State out from under the scoring thread
 		memset(state, 0, sizeof *state);
 	}
 #endif
-	Ball *ball = &state->ball;
+	SimContext *sim = &state->sim;
+	Ball *ball = &sim->ball;
 	GL *gl = &state->gl;
 	state->ctrl = input->keys_down[KEY_LCTRL] || input->keys_down[KEY_RCTRL];
 	state->shift = input->keys_down[KEY_LSHIFT] || input->keys_down[KEY_RSHIFT];
@@ -267,6 +949,9 @@ void sim_frame(Frame *frame) {
 	}
 	if (state->ctrl && keys_down[KEY_Q]) {
 		frame->close = true;
+	}
+	if (frame->close) {
+		scoring_thread_stop(state);
 		return;
 	}
 
@@ -327,38 +1012,24 @@ void sim_frame(Frame *frame) {
 	#undef optional_gl_proc
 	#undef required_gl_proc
 
-		make_directory("setups");
+		state->seed = (u64)time(NULL);
+		// leave a CPU for rendering
+		state->nthreads = thread_cpu_count() - 1;
+		state->ballistic_exit = true;
+		state->fitness_cache_enabled = true;
+		evolution_settings_default(state);
+		str_cpy(state->output_dir, sizeof state->output_dir, "setups");
+		make_directory(state->output_dir);
+		state->write_b2s = true; // keep writing setups/000.b2s, 001.b2s, ... like we always have
 
 		shaders_load(state);
 		
-		state->platform_thickness = 0.05f;
-		state->bottom_y = 0.1f;
-		state->left_x   = 0;
+		sim_init(sim);
 
 		text_font_load(state, &state->font, "assets/font.ttf", 36.0f);
 		text_font_load(state, &state->small_font, "assets/font.ttf", 18.0f);
 		text_font_load(state, &state->large_font, "assets/font.ttf", 72.0f);
 
-		b2Vec2 gravity(0, -9.81f);
-		b2World *world = state->world = new b2World(gravity);
-			
-		// create ground
-		b2BodyDef ground_body_def;
-		ground_body_def.position.Set(0.0f, -1000.0f);
-		b2Body *ground_body = world->CreateBody(&ground_body_def);
-
-		b2PolygonShape ground_shape;
-		ground_shape.SetAsBox(50.0f, 10.0f);
-		ground_body->CreateFixture(&ground_shape, 0.0f);
-
-		// create left wall
-		b2BodyDef left_wall_def;
-		left_wall_def.position.Set(state->left_x - 0.5f, 0);
-		b2Body *left_wall_body = world->CreateBody(&left_wall_def);
-		b2PolygonShape left_wall_shape;
-		left_wall_shape.SetAsBox(0.5f, 1000);
-		left_wall_body->CreateFixture(&left_wall_shape, 0);
-
 
 		#if 0
 		// make a bunch of random setups and pick the best one
@@ -407,17 +1078,30 @@ void sim_frame(Frame *frame) {
 
 	Platform *mouse_platform = platform_at_mouse_pos(state);
 
-	if (state->simulating) {
+	if (state->simulating && state->playing) {
+		// play back the recording. left/right go back/forward a second, R starts again
+		float duration = trajectory_duration(&state->trajectory);
+		state->playback_time += state->dt;
+		if (keys_pressed[KEY_LEFT]) state->playback_time -= 1;
+		if (keys_pressed[KEY_RIGHT]) state->playback_time += 1;
+		if (keys_pressed[KEY_R]) state->playback_time = 0;
+		state->playback_time = clampf(state->playback_time, 0, duration);
+		trajectory_apply(&state->trajectory, (u32)(state->playback_time / TIME_STEP), sim);
+	} else if (state->simulating) {
 		// simulate physics
 		float dt = state->dt;
 		if (dt > 100) dt = 100; // prevent floating-point problems for very large dt's
-		simulate_time(state, dt);
+		simulate_time(sim, dt);
+	}
+	if (state->simulating) {
 		if (keys_pressed[KEY_SPACE]) {
 			// edit this setup
 			state->building = true;
 			state->simulating = false;
+			state->playing = false;
 			keys_pressed[KEY_SPACE] = 0;
-			setup_reset(state);
+			setup_reset(sim);
+			state->setting_move_p2 = false;
 		}
 	}
 
@@ -552,16 +1236,16 @@ void sim_frame(Frame *frame) {
 					// edit platform
 					*platform_building = *mouse_platform;
 					platform_building->body = NULL;
-					platform_delete(state, mouse_platform);
+					platform_delete(sim, mouse_platform);
 					platform_building->color = (platform_building->color & 0xFFFFFF00) | 0x7F;
 				} else {
 					// left-click to build platform
-					if (state->nplatforms < MAX_PLATFORMS) {
+					if (sim->nplatforms < MAX_PLATFORMS) {
 						platform_building->start_angle = platform_building->angle;
-						Platform *p = &state->platforms[state->nplatforms++];
+						Platform *p = &sim->platforms[sim->nplatforms++];
 						*p = *platform_building;
 						p->color |= 0xFF; // set alpha to 255
-						platform_make_body(state, p, state->nplatforms - 1);
+						platform_make_body(sim, p, sim->nplatforms - 1);
 						state->setting_move_p2 = false;
 						platform_building->moves = false;
 					}
@@ -569,7 +1253,7 @@ void sim_frame(Frame *frame) {
 			} else if (button == MOUSE_RIGHT) {
 				if (mouse_platform) {
 					// right-click to delete platform
-					platform_delete(state, mouse_platform);
+					platform_delete(sim, mouse_platform);
 				}
 			}
 		}
@@ -577,7 +1261,8 @@ void sim_frame(Frame *frame) {
 		if (keys_pressed[KEY_SPACE]) {
 			state->building = false;
 			state->simulating = true;
-			setup_reset(state);
+			setup_reset(sim);
+			state->setting_move_p2 = false;
 		}
 	}
 
@@ -587,7 +1272,12 @@ void sim_frame(Frame *frame) {
 			// if any key was pressed last frame, show evolve menu now
 			state->evolve_menu = true;
 			state->start_menu = false;
-			start_evolution(state);
+			if (!make_initial_setups(state)) {
+				printf("Not enough memory for the setups.\n");
+				frame->close = true;
+				return;
+			}
+			scoring_thread_start(state);
 		}
 
 		if (input->nkey_presses) {
@@ -628,36 +1318,38 @@ void sim_frame(Frame *frame) {
 		pos = V2(-size.x * 0.5f, -size.y * 0.5f);
 		text_render(state, font, text, pos);
 	} else if (state->evolve_menu) {
+		ScoringSnapshot const *snapshot = scoring_snapshot_get(state);
+		bool evolving = atomic_load_i32(&state->scoring_command) != SCORING_STOP;
 		// handle input
-		if (!state->evolving && keys_pressed[KEY_SPACE]) {
-			start_generation(state);
-			state->run_one_generation = true;
+		if (!evolving && keys_pressed[KEY_SPACE]) {
+			atomic_store_i32(&state->scoring_command, SCORING_ONE_GENERATION);
 		}
 
 		if (keys_pressed[KEY_P]) {
-			if (state->evolving) {
-				state->evolving = false;
-			} else {
-				start_generation(state);
-				state->run_one_generation = false;
-			}
+			atomic_store_i32(&state->scoring_command, evolving ? SCORING_STOP : SCORING_RUN);
+		}
+		if (keys_pressed[KEY_L] && !recording_view(state, "recording.b2t")) {
+			printf("Couldn't play back recording.b2t (make it with boxcatapult2d-headless -record recording.b2t).\n");
 		}
+		evolving = atomic_load_i32(&state->scoring_command) != SCORING_STOP;
 
 		char text[128] = {};
 		// show generation
-		snprintf(text, sizeof text - 1, "Generation %llu", (ullong)state->generation);
+		snprintf(text, sizeof text - 1, "Generation %llu", (ullong)snapshot->generation);
 		v2 size = text_get_size(state, font, text);
 		v2 pos = V2(-size.x * 0.5f, 0.98f);
 		pos.y -= size.y * 1.5f;
-		if (state->evolving)	
+		if (evolving)
 			glColor3f(0.5f,1,0.5f);
 		else
 			glColor3f(1,1,1);
 		text_render(state, font, text, pos);
 
-		if (state->evolving) {
+		if (snapshot->ntop == 0) {
+			snprintf(text, sizeof text - 1, "(scoring the first %u setups)", (uint)state->nsetups);
+		} else if (evolving) {
 			snprintf(text, sizeof text - 1, "(running %u/%u)", 
-				(uint)state->scoring_next, (uint)GENERATION_SIZE);
+				(uint)snapshot->scoring_next, (uint)state->generation_size);
 		} else {
 			snprintf(text, sizeof text - 1, "(stopped)");
 		}
@@ -667,8 +1359,8 @@ void sim_frame(Frame *frame) {
 		text_render(state, font, text, pos);
 
 		pos.y -= 0.1f;
-		for (int i = 0; i < 9; ++i) {
-			Setup *setup = &state->setups[i];
+		for (int i = 0; i < 9 && i < (int)snapshot->ntop; ++i) {
+			Setup const *setup = &snapshot->top[i];
 			snprintf(text, sizeof text - 1, "%d. %.2fm in %.1fs (mutated %llu times)",
 				i+1, setup->score, setup->total_time, (ullong)setup->mutations);
 			size = text_get_size(state, font, text);
@@ -684,24 +1376,21 @@ void sim_frame(Frame *frame) {
 			for (MousePress *press = input->mouse_presses, *end = press + input->nmouse_presses; press != end; ++press) {
 				if (rect_contains_point(r, pixels_to_gl_coords(state, press->x, press->y))) {
 					// clicked on this setup
-					setup_use(state, &state->setups[i]);
-					state->evolve_menu = false;
-					state->evolving = false;
-					state->simulating = true;
+					setup_view(state, setup);
 				}
 			}
 			text_render(state, font, text, pos);
 		}
 
 		gl_color1f(0.8f);
-		if (!state->evolving) {
+		if (!evolving) {
 			snprintf(text, sizeof text - 1, "Press space to run a single generation.");
 			size = text_get_size(state, font, text);
 			pos.x = -size.x * 0.5f; pos.y -= size.y * 1.5f;
 			text_render(state, font, text, pos);
 		}
 
-		snprintf(text, sizeof text - 1, "Press P to %s running generations automatically.", state->evolving ? "stop" : "start");
+		snprintf(text, sizeof text - 1, "Press P to %s running generations automatically.", evolving ? "stop" : "start");
 		size = text_get_size(state, font, text);
 		pos.x = -size.x * 0.5f; pos.y -= size.y * 1.5f;
 		text_render(state, font, text, pos);
@@ -711,26 +1400,20 @@ void sim_frame(Frame *frame) {
 		pos.x = -size.x * 0.5f; pos.y -= size.y * 1.5f;
 		text_render(state, font, text, pos);
 
+		snprintf(text, sizeof text - 1, "Press L to play back recording.b2t.");
+		size = text_get_size(state, font, text);
+		pos.x = -size.x * 0.5f; pos.y -= size.y * 1.5f;
+		text_render(state, font, text, pos);
+
 		for (int i = 0; i < 9; ++i) {
-			if (keys_pressed[KEY_1 + i]) {
-				setup_use(state, &state->setups[i]);
-				state->evolve_menu = false;
-				state->evolving = false;
-				state->simulating = true;
+			if (keys_pressed[KEY_1 + i] && i < (int)snapshot->ntop) {
+				setup_view(state, &snapshot->top[i]);
 			}
 		}
 		
-		if (state->evolving) {
-			// score some setups!
-			struct timespec start_time = time_get();
-			do {
-				bool new_generation = score_one(state);
-				if (new_generation) {
-					if (state->run_one_generation) {
-						state->evolving = false;
-					}
-				}
-			} while (timespec_sub(time_get(), start_time) < 0.02f); // after 20ms, stop.
+		if (!state->scoring_thread_running) {
+			// no background thread; score some setups here
+			scoring_step(state);
 		}
 
 	} else {
@@ -739,7 +1422,7 @@ void sim_frame(Frame *frame) {
 			// turn platform under mouse blue
 			if (mouse_platform) mouse_platform->color = 0x007FFFFF;
 		}
-		platforms_render(state, state->platforms, state->nplatforms);
+		platforms_render(state, sim->platforms, sim->nplatforms);
 		if (state->building) {
 			if (mouse_platform) {
 				mouse_platform->color = prev_mouse_platform_color;
@@ -761,8 +1444,8 @@ void sim_frame(Frame *frame) {
 		ball_render(state);
 
 		{
-			float bottom_y = m4_mul_v3(state->transform, V3(0, state->bottom_y, 0)).y;
-			float left_x = m4_mul_v3(state->transform, V3(state->left_x, 0, 0)).x;
+			float bottom_y = m4_mul_v3(state->transform, V3(0, sim->bottom_y, 0)).y;
+			float left_x = m4_mul_v3(state->transform, V3(sim->left_x, 0, 0)).x;
 
 			glBegin(GL_LINES);
 			glColor3f(1,0,0);
@@ -792,7 +1475,7 @@ void sim_frame(Frame *frame) {
 			glEnd();
 
 			if (state->simulating) { // starting line & distance traveled
-				float starting_line = platforms_starting_line(state->platforms, state->nplatforms);
+				float starting_line = platforms_starting_line(sim->platforms, sim->nplatforms);
 				float starting_line_gl = b2_to_gl(state, V2(starting_line, 0)).x;
 				glBegin(GL_LINES);
 				glColor3f(1,1,0);
@@ -800,8 +1483,10 @@ void sim_frame(Frame *frame) {
 				glVertex2f(starting_line_gl, +1);
 				glEnd();
 
+				// (when playing back, the ball has no body, since the setup was simulated to get the recording)
+				bool done = state->playing ? state->playback_time >= trajectory_duration(&state->trajectory) : !ball->body;
 				char dist_text[64] = {0};
-				if (ball->body)
+				if (!done)
 					glColor4f(0.8f,0.8f,0.8f,0.8f); // still going
 				else
 					glColor4f(0.5f,1,0.5f,1.0f); // done
@@ -809,7 +1494,7 @@ void sim_frame(Frame *frame) {
 				v2 dist_size = text_get_size(state, font, dist_text);
 
 				char best_text[64] = {0};
-				snprintf(best_text, sizeof best_text - 1, "Best distance: %.2f m", state->furthest_ball_x_pos - starting_line);
+				snprintf(best_text, sizeof best_text - 1, "Best distance: %.2f m", sim->furthest_ball_x_pos - starting_line);
 				v2 best_size = text_get_size(state, font, best_text);
 
 
@@ -819,7 +1504,7 @@ void sim_frame(Frame *frame) {
 				pos.y -= best_size.y;
 				text_render(state, font, best_text, pos);
 				
-				if (!ball->body) {
+				if (done) {
 					// done simulating, show instructions for what to do next
 					char text1[64] = {}, text2[64] = {};
 					glColor3f(1,1,1);
@@ -848,13 +1533,13 @@ void sim_frame(Frame *frame) {
 			v2 pos = V2(1 - size.x, -1 + size.y);
 			text_render(state, small_font, text, pos);
 			// stuck time
-			snprintf(text, sizeof text - 1, "Last record: %.1fs ago", state->stuck_time);
+			snprintf(text, sizeof text - 1, "Last record: %.1fs ago", sim->stuck_time);
 			size = text_get_size(state, small_font, text);
 			pos.x = 1 - size.x;
 			pos.y += size.y * 1.5f;
 			text_render(state, small_font, text, pos);
 			// total time
-			snprintf(text, sizeof text - 1, "Total time: %.1fs", state->total_time);
+			snprintf(text, sizeof text - 1, "Total time: %.1fs", sim->total_time);
 			size = text_get_size(state, small_font, text);
 			pos.x = 1 - size.x;
 			pos.y += size.y * 1.5f;
@@ -866,12 +1551,10 @@ void sim_frame(Frame *frame) {
 	if (state->simulating || state->building) {
 		if (keys_pressed[KEY_ESCAPE]) {
 			// back to evolve menu
-			if (ball->body) {
-				// destroy ball if needed
-				state->world->DestroyBody(ball->body);
-				ball->body = NULL;
-			}
+			// destroy ball if needed
+			ball_remove_body(sim);
 			state->simulating = false;
+			state->playing = false;
 			state->building = false;
 			state->evolve_menu = true;
 			keys_pressed[KEY_ESCAPE] = 0;
@@ -885,3 +1568,4 @@ void sim_frame(Frame *frame) {
 	}
 	#endif
 }
+#endif // !HEADLESS
@@ -7,11 +7,13 @@
 #include <box2d/box2d.h>
 #endif
 
+#if !HEADLESS
 #define STBTT_STATIC
 #define STB_TRUETYPE_IMPLEMENTATION
 no_warn_start
 #include "lib/stb_truetype.h"
 no_warn_end
+#endif
 
 // enums with a specified width are a clang C extension & available in C++11
 #if defined __clang__ || __cplusplus >= 201103L
@@ -33,6 +35,7 @@ no_warn_end
 #define maybe_unused
 #endif
 
+#if !HEADLESS
 typedef void (APIENTRY *GLAttachShader)(GLuint program, GLuint shader);
 typedef void (APIENTRY *GLCompileShader)(GLuint shader);
 typedef GLuint (APIENTRY *GLCreateProgram)(void);
@@ -124,6 +127,7 @@ typedef struct {
 	ShaderBase base;
 	UniformLocation uniform_transform, uniform_center, uniform_radius;
 } ShaderBall;
+#endif // !HEADLESS
 
 typedef struct {
 	b2Body *body; // Box2D body for platform -- created when setup_use is called (for setups), or when the platform is manually built
@@ -165,14 +169,287 @@ typedef struct {
 #define USER_DATA_PLATFORM (USER_DATA_TYPE_PLATFORM << USER_DATA_TYPE_SHIFT)
 
 #define MAX_PLATFORMS 32
+#define MAX_PATH_BOXES 32
+#define MAX_CHECKPOINTS 8
+
+typedef struct {
+	v2 pos, velocity;
+	float angle, angular_velocity;
+} BodyCheckpoint;
+
+// the state of a simulation part way through, taken when the ball isn't touching anything
+// (so there's nothing in Box2D's contacts that we'd need to save)
+typedef struct {
+	u32 step; // SetupRecord.nsteps when this was taken
+	u32 touched; // SetupRecord.touched when this was taken
+	float stuck_time, total_time, furthest_ball_x_pos;
+	float dt_left; // time left to simulate in the simulate_time call this was taken in
+	BodyCheckpoint ball;
+	BodyCheckpoint platforms[MAX_PLATFORMS];
+} SimCheckpoint;
+
+// what happened the last time a setup was simulated (only recorded if State.incremental or State.checkpoints is set).
+// these are kept in State.records, not in the Setups, because they're much bigger than the setups themselves.
+typedef struct {
+	bool valid; // false if this setup hasn't been simulated with recording on
+	bool reused; // this setup's score was copied from its parent's without simulating it
+	u32 resume_checkpoint; // if this isn't 0, setup_score starts from checkpoints[resume_checkpoint-1] instead of the start
+	u32 resume_replay; // bit i is set if platform i is different from the one the checkpoints were taken with
+	u32 resumed_step; // step the last simulation of this setup started from (0 if it started from the start)
+	u32 touched; // bit i is set if the ball touched platform i
+	u32 nsteps; // number of ball positions recorded
+	// the ball's path (not including its radius) is covered by these boxes, each of which covers
+	// steps_per_box time steps. when we run out of boxes, neighbouring ones are merged.
+	u32 nboxes;
+	u32 steps_per_box;
+	u32 steps_in_last_box;
+	Rect boxes[MAX_PATH_BOXES];
+	// a checkpoint is taken (at least) checkpoint_every steps after the last one.
+	// when we run out of room, every other one is thrown away.
+	u32 checkpoint_every;
+	u32 ncheckpoints;
+	SimCheckpoint checkpoints[MAX_CHECKPOINTS];
+} SetupRecord;
+
 typedef struct {
 	float score; // distance this setup can throw the ball
 	float total_time; // time it took to finish
+	u32 nsteps; // number of Box2D steps the last simulation of this setup took
+	bool pruned; // the last simulation was stopped early because this couldn't make it into the top (score is an upper bound)
+	float novelty; // how different this setup's behaviour is from the ones in the novelty archive (see novelty.cpp)
 	u64 mutations;
+	u32 group; // 1 + the index of the mutation group this setup was made by (0 for random initial setups and immigrants)
 	u32 nplatforms;
 	Platform platforms[MAX_PLATFORMS];
 } Setup;
 
+// remembers which platforms the ball has touched
+class PlatformContactListener : public b2ContactListener {
+public:
+	u32 touched = 0; // bit i is set if the ball has touched platform i
+	i32 ntouching = 0; // number of things the ball is touching right now
+	void BeginContact(b2Contact *contact) override;
+	void EndContact(b2Contact *contact) override;
+};
+
+#define TRAJECTORY_KEYFRAME_EVERY 64
+#define TRAJECTORY_NVALUES (2 + 3 * MAX_PLATFORMS) // most numbers in a frame
+typedef struct {
+	u32 offset; // where the frame starts in Trajectory.data
+	i32 furthest_x; // the furthest right the ball has been, up to and including this frame
+} TrajectoryKeyframe;
+
+// where the ball and the moving/rotating platforms were at every time step of a simulation,
+// quantized and delta-encoded (see trajectory.cpp)
+typedef struct {
+	u32 nplatforms;
+	u32 moving; // bit i is set if platform i moves or rotates (only those platforms are recorded)
+	u32 nframes; // frame i is after i time steps
+	u8 *data;
+	u32 size, cap;
+	// every TRAJECTORY_KEYFRAME_EVERY'th frame isn't delta-encoded, so that decoding can start there
+	TrajectoryKeyframe *keyframes;
+	u32 nkeyframes, keyframes_cap;
+	i32 last[TRAJECTORY_NVALUES]; // the last frame recorded
+	i32 furthest_x;
+	bool failed; // ran out of memory while recording
+} Trajectory;
+
+// everything needed to simulate a setup. this is kept separate from the rest of the State,
+// so that there can be lots of these (e.g. one for each scoring thread).
+typedef struct {
+	b2World *world; // Box2D world
+
+	Ball ball;
+	float furthest_ball_x_pos; // furthest distance the ball has reached
+	float stuck_time; // amount of time furthest_ball_x_pos hasn't changed for
+	float total_time; // amount of time the simulation has been running for
+
+	// physics time left unsimulated last frame
+	// (we need to always pass Box2D the same dt for consistency, so there
+	// will be some left over, if the frame time is not a multiple of the fixed time step)
+	float time_residue;
+
+	float bottom_y; // y-position of "floor" (if y goes below here, it's over)
+	float left_x; // y-position of left wall
+	float platform_thickness;
+
+	u32 nplatforms;
+	Platform platforms[MAX_PLATFORMS];
+
+	// if this is set, once the ball is in free flight to the right of every platform,
+	// we work out where it lands instead of simulating the rest of its flight
+	bool ballistic_exit;
+	bool ballistic_exited; // did the last simulation end that way?
+	float platforms_right_x; // the ball can't touch a platform if it's to the right of this
+
+	// if this is set, bodies are disabled and kept for later instead of being destroyed,
+	// and setup_score reuses the world instead of making a new one.
+	// this is faster, but a setup's score then depends (a tiny bit) on what was simulated before it.
+	bool pool_bodies;
+	b2Body *ball_body_pool; // disabled ball body, or NULL
+	u32 nplatform_body_pool;
+	b2Body *platform_body_pool[MAX_PLATFORMS]; // disabled platform bodies
+
+	// if this is set, the simulation is stopped as soon as the ball can't possibly get a score above prune_score
+	// (see simulate_prune)
+	bool prune;
+	float prune_score;
+	float prune_x; // prune_score + the setup's starting line
+	float kinematic_bottom_y; // the lowest any moving or rotating platform goes
+	bool pruned; // was the last simulation stopped that way?
+	u32 nsteps; // number of Box2D steps taken in the last simulation
+
+	// if this isn't NULL, setup_score records everything that happens in it.
+	// ballistic_exit and prune should be off, since they skip the end of the simulation.
+	Trajectory *trajectory;
+	bool record; // set by setup_score while it's recording what happens
+	SetupRecord record_current; // record of the setup being simulated
+	PlatformContactListener *contact_listener;
+} SimContext;
+
+#define MAX_THREADS 256
+
+typedef struct {
+	u32 nscored; // number of setups this thread scored
+	u32 nstolen; // how many of those it stole from other threads
+	double busy_time; // seconds spent scoring
+	double idle_time; // seconds spent waiting for the other threads to finish
+} ScoringThreadStats;
+
+typedef struct {
+	u32 nscreened; // number of setups the surrogate looked at
+	u32 nskipped; // number of those which weren't scored properly
+	// the rest of these are only filled in if State.surrogate_report is set
+	// (then the skipped setups are scored properly anyway, to check)
+	u32 nwrongly_skipped; // skipped setups which would have made it into the top setups
+	double total_error; // sum of |approximate score - real score|
+	double sum_a, sum_r, sum_aa, sum_rr, sum_ar; // sums of approximate/real scores, their squares and products
+} SurrogateStats;
+
+typedef struct {
+	u32 nreused; // number of setups which got their parent's score
+	u32 nverified; // number of those which were simulated anyway to check
+	u32 nmismatches; // number of those whose score wasn't the same as their parent's
+	float max_difference; // biggest difference between the real score and the parent's
+} IncrementalStats;
+
+typedef struct {
+	u32 nresumed; // number of setups which were resumed from a checkpoint
+	u64 nsteps_skipped; // time steps which didn't need to be simulated because of that
+	u64 nsteps; // time steps in all the simulations, including the skipped ones
+	u32 nchecked; // number of resumed setups which were also simulated from the start
+	u32 nmismatches; // number of those which got a different score
+	float max_difference; // biggest difference between the resumed and from-the-start scores
+} CheckpointStats;
+
+typedef struct {
+	u32 nsetups; // number of new setups which were simulated
+	u32 npruned; // number of them which were pruned
+	u64 nsteps; // Box2D steps taken simulating them
+	u64 nsteps_pruned; // steps taken by the ones which were pruned
+	u32 nchecked; // number of pruned setups which were simulated again without pruning
+	u32 nwrong; // number of those which would have made it into the top
+	u64 nsteps_checked; // Box2D steps the checked setups took, without pruning
+	u64 nsteps_saved; // steps pruning saved for the checked setups
+} PruneStats;
+
+// the history of a run: the top setups of every generation (see history.cpp). this is only used by the writer thread.
+typedef struct {
+	FILE *data_fp; // history.b2h, NULL if the history isn't being recorded
+	FILE *index_fp; // history.idx
+	u64 data_size; // size of history.b2h
+	bool failed; // something couldn't be written, so nothing more will be
+} History;
+
+#define WRITER_QUEUE_SIZE 4 // must be a power of 2
+// a file for the writer thread to write (see writer.cpp)
+typedef struct {
+	char filename[512];
+	History *history; // if this isn't NULL, data is appended to this history instead of written to filename
+	u8 *data; // freed once it's been written
+	size_t size;
+} WriteJob;
+
+// files are written on this thread, so that scoring doesn't wait for the disk
+typedef struct {
+	bool running;
+	Thread thread;
+	i32 volatile quit;
+	// jobs[head % WRITER_QUEUE_SIZE] is the next one to be written, and jobs[tail % WRITER_QUEUE_SIZE] the next one to be added.
+	// only the writer thread changes head, and only the thread scoring setups changes tail.
+	i32 volatile head, tail;
+	WriteJob jobs[WRITER_QUEUE_SIZE];
+	i32 volatile nfailed; // number of files which couldn't be written
+	// these are only used by the thread scoring setups
+	u64 nwritten; // number of files given to the writer
+	double wait_time; // seconds spent waiting for files to be written, because the queue was full (or there's no writer thread)
+} Writer;
+
+typedef struct {
+	u64 hash; // fitness_hash of the setup, or 0 if this entry is empty
+	float score;
+	float total_time;
+} FitnessCacheEntry;
+
+#define FITNESS_CACHE_SIZE (1<<14) // must be a power of 2
+
+#define DEFAULT_GENERATION_SIZE 100
+#define DEFAULT_TOP_KEPT 10
+
+#define MUTATION_RANDOM (-1.0f) // mutation rate for a group of completely random setups
+#define MAX_MUTATION_GROUPS 16
+// the new setups of each generation are split into groups, each of which are made in the same way
+typedef struct {
+	u32 weight; // what proportion of the new setups are in this group (relative to the other groups' weights)
+	float mutation_rate; // chance of each platform being mutated, or MUTATION_RANDOM
+	// these are set by mutation_groups_allocate and setups_select_top
+	u32 nsetups; // number of new setups in this group this generation
+	u32 yield; // number of this generation's setups from this group which made it into the top setups
+	double trials, wins; // totals of nsetups and yield over all generations so far, with older ones counting for less
+} MutationGroup;
+
+// a cell of the novelty archive's grid
+typedef struct {
+	i32 x, y;
+	u32 head; // index of the first behaviour in this cell, or NOVELTY_NONE if this hash table entry is empty
+} NoveltyCell;
+
+// the behaviours of setups seen so far, for State.novelty (see novelty.cpp)
+typedef struct {
+	u32 n, cap;
+	v2 *behaviours;
+	u32 *next; // next[i] is the next behaviour in the same cell as behaviour i, or NOVELTY_NONE
+	u32 ncells, cells_cap; // cells_cap is a power of 2
+	NoveltyCell *cells; // hash table
+	i32 min_x, max_x, min_y, max_y; // bounds of the cells which have behaviours in them
+	float add_threshold; // setups more novel than this are added
+	u32 nadded; // number of behaviours added by the last novelty_update
+} NoveltyArchive;
+
+#define SNAPSHOT_TOP 10 // number of top setups in a ScoringSnapshot
+
+// what setups are ranked by (see setups_select_top)
+typedef struct {
+	float score;
+	u32 position; // used to break ties: the rank of a top setup, or top_kept + i for the i'th new setup
+	u32 index; // index into State.setups
+} SetupKey;
+
+// what the evolve menu shows, published by the background scoring thread
+typedef struct {
+	u64 generation;
+	u32 scoring_next;
+	u32 ntop;
+	Setup top[SNAPSHOT_TOP];
+} ScoringSnapshot;
+
+typedef enum {
+	SCORING_STOP,
+	SCORING_ONE_GENERATION, // finish this generation, then stop
+	SCORING_RUN
+} ScoringCommand;
+
 typedef struct {
 	bool initialized;
 
@@ -186,55 +463,122 @@ typedef struct {
 
 	float dt; // time in seconds since last frame
 
-	// physics time left unsimulated last frame
-	// (we need to always pass Box2D the same dt for consistency, so there
-	// will be some left over, if the frame time is not a multiple of the fixed time step)
-	float time_residue; 
 	m4 transform; // the transform for converting our coordinates to GL coordinates
 	m4 inv_transform; // inverse of transform (for converting GL coordinates to our coordinates)
 
+#if !HEADLESS
 	GL gl; // gl functions
 	ShaderPlatform shader_platform;
 	ShaderBall shader_ball;
+#endif
 
 	bool start_menu; // "press any key to begin"
 	bool pressed_any_key_to_begin; // we need to delay beginning by a frame to show "Loading..."
 	bool building; // is the user building a setup?
 	bool setting_move_p2; // is the user setting the move_p2 of the platform they're placing?
 	bool simulating; // are we simulating the world's physics?
+	// if this is set (along with simulating), the setup is being played back from trajectory instead of simulated
+	bool playing;
+	float playback_time;
+	Trajectory trajectory;
 	bool evolve_menu; // is the evolve menu shown?
-	bool evolving; // are we simulating generations?
-	bool run_one_generation; // only run one generation, then stop.
+
+	// the GUI scores setups on a background thread, so that rendering and scoring don't wait for each other.
+	// it tells the thread what to do with scoring_command, and the thread tells it how it's going with
+	// a triple-buffered snapshot: the thread fills in snapshots[snapshot_back], then swaps it with snapshot_middle;
+	// the GUI swaps snapshot_front with snapshot_middle whenever there's a new one there.
+	i32 volatile scoring_command; // a ScoringCommand
+	i32 volatile scoring_quit; // set to tell the scoring thread to exit
+	bool scoring_thread_running;
+	Thread scoring_thread;
+	ScoringSnapshot snapshots[3];
+	i32 volatile snapshot_middle; // index into snapshots, | SNAPSHOT_NEW if the GUI hasn't seen it yet
+	i32 snapshot_back; // only used by the scoring thread
+	i32 snapshot_front; // only used by the GUI
 
 	u32 scoring_next; // which of this generation's setups we are scoring next
+	u32 nthreads; // number of threads to score setups on (0 or 1 means just score them on this thread)
+	// each scoring thread has its own SimContext to simulate setups in.
+	// the first thread's is scoring_sim, and the others are only allocated once they're needed (thread_sims[0] isn't used).
+	SimContext scoring_sim;
+	SimContext *thread_sims[MAX_THREADS];
+	u32 nthread_stats;
+	ScoringThreadStats thread_stats[MAX_THREADS]; // stats for each thread from the last time setups were scored
 
 	u64 generation; // which generation we are on
-
-	b2World *world; // Box2D world
-
-	Ball ball;
-	float furthest_ball_x_pos; // furthest distance the ball has reached
-	float stuck_time; // amount of time furthest_ball_x_pos hasn't changed for
-	float total_time; // amount of time the simulation has been running for
-
-	float bottom_y; // y-position of "floor" (if y goes below here, it's over)
-	float left_x; // y-position of left wall
+	u64 seed; // random seed for this evolution (the same seed always gives the same setups)
+	bool ballistic_exit; // use SimContext.ballistic_exit when scoring setups
+	bool pool_bodies; // use SimContext.pool_bodies when scoring setups
+	// if this is set, new setups which the surrogate simulator thinks are more than surrogate_margin meters
+	// worse than the worst of the top setups just get their approximate score, and aren't simulated with Box2D
+	bool surrogate_screen;
+	bool surrogate_report; // fill in all of surrogate_stats
+	float surrogate_margin;
+	SurrogateStats surrogate_stats; // stats since this was last reset
+	// don't simulate setups which have already been simulated (e.g. children which are the same as their parent)
+	bool fitness_cache_enabled;
+	u64 fitness_cache_hits, fitness_cache_misses;
+	FitnessCacheEntry fitness_cache[FITNESS_CACHE_SIZE];
+	// if this is set, children whose mutations can't have changed what happened to the ball
+	// (going by their parent's record) just get their parent's score.
+	// this can occasionally be wrong, because Box2D's results also depend on platforms the ball doesn't touch
+	// (e.g. through the order things are kept in), which is why there's incremental_verify.
+	bool incremental;
+	u32 incremental_verify; // simulate this many of the setups which weren't simulated each time, to check
+	IncrementalStats incremental_stats; // stats since this was last reset
+	// if this is set, children start simulating from the last checkpoint of their parent's
+	// before the ball got near anything which was mutated
+	bool checkpoints;
+	bool checkpoints_check; // also simulate resumed setups from the start, to check that they get the same score
+	CheckpointStats checkpoint_stats; // stats since this was last reset
+	// if this is set, new setups stop being simulated as soon as they can't make it into the top (see simulate_prune)
+	bool prune;
+	bool prune_check; // also simulate pruned setups fully, to check that they really couldn't have made it into the top
+	bool pruning; // set while new setups are being scored, if prune is
+	PruneStats prune_stats; // stats since this was last reset
+	char output_dir[256]; // directory where the setups of each generation are saved (see population.cpp)
+	bool write_b2s; // also save each of the top setups as a .b2s file
+	Writer writer;
+	History history;
+
+	SimContext sim; // the setup being shown/edited
 
 	v2 pan; // pan for the editor
 
+#if !HEADLESS
 	Font font;
 	Font small_font;
 	Font large_font;
+#endif
 
 	Platform platform_building; // the platform the user is currently placing
-	float platform_thickness;
-
-	u32 nplatforms;
-	Platform platforms[MAX_PLATFORMS];
 
-#define GENERATION_SIZE 100
-#define TOP_KEPT 10 // keep top this many setups after every generation
-	Setup setups[TOP_KEPT + GENERATION_SIZE];
+	u32 generation_size; // number of new setups made each generation
+	u32 top_kept; // keep top this many setups after every generation
+	u32 nmutation_groups;
+	MutationGroup mutation_groups[MAX_MUTATION_GROUPS];
+	bool adaptive_groups; // give more new setups to the mutation groups whose setups have been making it into the top
+	// the top top_kept setups from the last generation (in no particular order), followed by the generation_size new ones.
+	// this is allocated by start_evolution (it can be much too big for the frame memory).
+	Setup *setups;
+	// records[i] is what happened the last time setups[i] was simulated (see incremental.cpp).
+	// this is NULL unless incremental or checkpoints is set.
+	SetupRecord *records;
+	u32 nsetups; // = top_kept + generation_size
+	u32 *top; // top[r] is the index into setups of the r'th best setup (see setup_top), r < top_kept
+	SetupKey *setup_keys; // nsetups of these, used by setups_select_top
+	bool *top_slot_kept; // top_kept of these, used by setups_select_top
+	// if this is set, the top setups are the ones which are best at being far, fast and cheap all at once,
+	// instead of just far (see pareto.cpp)
+	bool pareto;
+	u32 pareto_front_size; // number of the top setups which were in the first front the last time they were selected
+	Setup *pareto_archive; // the best setups seen so far, for State.pareto
+	u32 npareto_archive;
+	// if this is set, setups are ranked by score + novelty_weight * novelty,
+	// so that setups which do something new are kept, not just ones which throw the ball far (see novelty.cpp)
+	bool novelty;
+	float novelty_weight;
+	NoveltyArchive novelty_archive;
 
 	u32 tmp_mem_used; // this is not measured in bytes, but in MaxAligns 
 #define TMP_MEM_BYTES (4L<<20)
@@ -0,0 +1,336 @@
+/*
+A much cheaper (and only approximately right) simulator, used to guess which setups aren't worth scoring with Box2D.
+It only knows about what a Setup can contain: one ball against some kinematic boxes (and the left wall).
+SURROGATE_LANES setups are simulated at once, with each one in its own SIMD lane.
+*/
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SURROGATE_SSE 1
+#endif
+
+#define SURROGATE_LANES 4
+
+// 4 floats. a "mask" is an f4 where every lane is either all 1 bits (true) or all 0 bits (false).
+#if SURROGATE_SSE
+typedef __m128 f4;
+static f4 f4_set1(float x) { return _mm_set1_ps(x); }
+static f4 f4_load(float const *p) { return _mm_loadu_ps(p); }
+static void f4_store(float *p, f4 a) { _mm_storeu_ps(p, a); }
+static f4 f4_add(f4 a, f4 b) { return _mm_add_ps(a, b); }
+static f4 f4_sub(f4 a, f4 b) { return _mm_sub_ps(a, b); }
+static f4 f4_mul(f4 a, f4 b) { return _mm_mul_ps(a, b); }
+static f4 f4_div(f4 a, f4 b) { return _mm_div_ps(a, b); }
+static f4 f4_min(f4 a, f4 b) { return _mm_min_ps(a, b); }
+static f4 f4_max(f4 a, f4 b) { return _mm_max_ps(a, b); }
+static f4 f4_sqrt(f4 a) { return _mm_sqrt_ps(a); }
+static f4 f4_lt(f4 a, f4 b) { return _mm_cmplt_ps(a, b); }
+static f4 f4_and(f4 a, f4 b) { return _mm_and_ps(a, b); }
+static f4 f4_or(f4 a, f4 b) { return _mm_or_ps(a, b); }
+static f4 f4_andnot(f4 a, f4 b) { return _mm_andnot_ps(a, b); } // (not a) and b
+static bool f4_any(f4 mask) { return _mm_movemask_ps(mask) != 0; }
+#else
+typedef struct { float e[4]; } f4;
+static f4 f4_set1(float x) { f4 r; for (int i = 0; i < 4; ++i) r.e[i] = x; return r; }
+static f4 f4_load(float const *p) { f4 r; memcpy(r.e, p, sizeof r.e); return r; }
+static void f4_store(float *p, f4 a) { memcpy(p, a.e, sizeof a.e); }
+#define f4_op(name, expr) static f4 name(f4 a, f4 b) { f4 r; for (int i = 0; i < 4; ++i) { float x = a.e[i], y = b.e[i]; r.e[i] = (expr); } return r; }
+f4_op(f4_add, x + y)
+f4_op(f4_sub, x - y)
+f4_op(f4_mul, x * y)
+f4_op(f4_div, x / y)
+f4_op(f4_min, x < y ? x : y)
+f4_op(f4_max, x > y ? x : y)
+#undef f4_op
+static f4 f4_sqrt(f4 a) { f4 r; for (int i = 0; i < 4; ++i) r.e[i] = sqrtf(a.e[i]); return r; }
+static f4 f4_from_bits(u32 const *bits) { f4 r; memcpy(r.e, bits, sizeof r.e); return r; }
+static f4 f4_lt(f4 a, f4 b) { u32 bits[4]; for (int i = 0; i < 4; ++i) bits[i] = a.e[i] < b.e[i] ? U32_MAX : 0; return f4_from_bits(bits); }
+#define f4_bit_op(name, expr) static f4 name(f4 a, f4 b) { u32 x[4], y[4]; memcpy(x, a.e, sizeof x); memcpy(y, b.e, sizeof y); \
+	for (int i = 0; i < 4; ++i) x[i] = (expr); return f4_from_bits(x); }
+f4_bit_op(f4_and, x[i] & y[i])
+f4_bit_op(f4_or, x[i] | y[i])
+f4_bit_op(f4_andnot, ~x[i] & y[i])
+#undef f4_bit_op
+static bool f4_any(f4 mask) { u32 x[4]; memcpy(x, mask.e, sizeof x); return (x[0] | x[1] | x[2] | x[3]) != 0; }
+#endif
+static f4 f4_gt(f4 a, f4 b) { return f4_lt(b, a); }
+static f4 f4_select(f4 mask, f4 a, f4 b) { return f4_or(f4_and(mask, a), f4_andnot(mask, b)); } // mask ? a : b
+static f4 f4_clamp(f4 x, f4 a, f4 b) { return f4_max(a, f4_min(x, b)); }
+
+// the platforms in one slot of a batch (platform i of each of the setups)
+typedef struct {
+	f4 x, y; // center
+	f4 vx, vy; // velocity (for moving platforms)
+	f4 cos_angle, sin_angle;
+	f4 cos_step, sin_step; // rotation in one time step
+	f4 angular_velocity;
+	f4 half_width;
+	f4 p1x, p1y, dirx, diry, length; // moving platforms go back and forth between p1 and p1 + length * dir
+	f4 moves; // mask
+} SurrogatePlatforms;
+
+// approximate the scores of *setups[0..nsetups) (which can be at most SURROGATE_LANES)
+static void surrogate_score_batch(SimContext const *sim, Setup const *const *setups, u32 nsetups, float *scores) {
+	float const time_step = TIME_STEP;
+	float const ball_radius = BALL_RADIUS;
+	float const restitution = BALL_RESTITUTION;
+	float const friction = sqrtf(BALL_FRICTION * PLATFORM_FRICTION); // Box2D mixes the ball's and the platforms' friction like this
+	float const restitution_threshold = 1.0f; // Box2D doesn't bounce for slower collisions than this
+	float const max_stuck_time = 10;
+	float const max_time = 120; // give up after this long
+
+	SurrogatePlatforms platforms[MAX_PLATFORMS];
+	u32 max_nplatforms = 0;
+	float starting_line[SURROGATE_LANES] = {0}, right_x[SURROGATE_LANES] = {0};
+	for (u32 lane = 0; lane < nsetups; ++lane) {
+		Setup const *setup = setups[lane];
+		starting_line[lane] = platforms_starting_line(setup->platforms, setup->nplatforms);
+		right_x[lane] = starting_line[lane] + sim->platform_thickness + 0.1f;
+		if (setup->nplatforms > max_nplatforms) max_nplatforms = setup->nplatforms;
+	}
+	for (u32 i = 0; i < max_nplatforms; ++i) {
+		// fill in the slot one float at a time (this isn't the slow part)
+		float x[4] = {0}, y[4] = {0}, vx[4] = {0}, vy[4] = {0}, cos_angle[4] = {0}, sin_angle[4] = {0},
+			cos_step[4] = {0}, sin_step[4] = {0}, angular_velocity[4] = {0}, half_width[4] = {0},
+			p1x[4] = {0}, p1y[4] = {0}, dirx[4] = {0}, diry[4] = {0}, length[4] = {0};
+		u32 moves[4] = {0};
+		for (u32 lane = 0; lane < SURROGATE_LANES; ++lane) {
+			if (lane >= nsetups || i >= setups[lane]->nplatforms) {
+				y[lane] = -1e6f; // no platform here; put it somewhere the ball can't get to
+				cos_angle[lane] = cos_step[lane] = 1;
+				continue;
+			}
+			Platform const *p = &setups[lane]->platforms[i];
+			v2 center = p->moves ? p->move_p1 : p->center;
+			x[lane] = center.x;
+			y[lane] = center.y;
+			cos_angle[lane] = cosf(p->start_angle);
+			sin_angle[lane] = sinf(p->start_angle);
+			cos_step[lane] = cosf(p->rotate_speed * time_step);
+			sin_step[lane] = sinf(p->rotate_speed * time_step);
+			angular_velocity[lane] = p->rotate_speed;
+			half_width[lane] = p->radius;
+			if (p->moves) {
+				v2 d = v2_sub(p->move_p2, p->move_p1);
+				float len = v2_len(d);
+				if (len > 0) {
+					moves[lane] = U32_MAX;
+					p1x[lane] = p->move_p1.x;
+					p1y[lane] = p->move_p1.y;
+					dirx[lane] = d.x / len;
+					diry[lane] = d.y / len;
+					length[lane] = len;
+					vx[lane] = dirx[lane] * p->move_speed;
+					vy[lane] = diry[lane] * p->move_speed;
+				}
+			}
+		}
+		SurrogatePlatforms *s = &platforms[i];
+		s->x = f4_load(x); s->y = f4_load(y);
+		s->vx = f4_load(vx); s->vy = f4_load(vy);
+		s->cos_angle = f4_load(cos_angle); s->sin_angle = f4_load(sin_angle);
+		s->cos_step = f4_load(cos_step); s->sin_step = f4_load(sin_step);
+		s->angular_velocity = f4_load(angular_velocity);
+		s->half_width = f4_load(half_width);
+		s->p1x = f4_load(p1x); s->p1y = f4_load(p1y);
+		s->dirx = f4_load(dirx); s->diry = f4_load(diry);
+		s->length = f4_load(length);
+		float moves_f[4];
+		memcpy(moves_f, moves, sizeof moves_f);
+		s->moves = f4_load(moves_f);
+	}
+
+	f4 const zero = f4_set1(0), one = f4_set1(1), h = f4_set1(time_step);
+	f4 const r = f4_set1(ball_radius), r2 = f4_set1(ball_radius * ball_radius);
+	f4 const half_height = f4_set1(sim->platform_thickness);
+	f4 const bottom = f4_set1(sim->bottom_y + ball_radius), left = f4_set1(sim->left_x + ball_radius);
+	f4 const gravity_step = f4_set1(GRAVITY * time_step);
+	f4 const e = f4_set1(restitution), mu = f4_set1(friction), bounce_speed = f4_set1(restitution_threshold);
+	f4 const platforms_right = f4_load(right_x);
+
+	f4 bx = f4_set1(BALL_STARTING_POS.x), by = f4_set1(BALL_STARTING_POS.y);
+	f4 bvx = zero, bvy = zero, bw = zero; // ball velocity and angular velocity
+	f4 furthest = zero, stuck_time = zero, time = zero;
+	f4 landed_x = zero;
+	float alive_init[4];
+	for (u32 lane = 0; lane < SURROGATE_LANES; ++lane) {
+		u32 bits = lane < nsetups ? U32_MAX : 0;
+		memcpy(&alive_init[lane], &bits, sizeof bits);
+	}
+	f4 alive = f4_load(alive_init);
+
+	while (f4_any(alive)) {
+		// integrate the ball, like Box2D: velocity first, then position
+		f4 nbvy = f4_add(bvy, gravity_step);
+		f4 nbvx = bvx;
+		f4 nbx = f4_add(bx, f4_mul(nbvx, h));
+		f4 nby = f4_add(by, f4_mul(nbvy, h));
+		f4 nbw = bw;
+
+		for (u32 i = 0; i < max_nplatforms; ++i) {
+			SurrogatePlatforms *p = &platforms[i];
+			// move platform
+			p->x = f4_add(p->x, f4_mul(p->vx, h));
+			p->y = f4_add(p->y, f4_mul(p->vy, h));
+			f4 along = f4_add(f4_mul(f4_sub(p->x, p->p1x), p->dirx), f4_mul(f4_sub(p->y, p->p1y), p->diry));
+			f4 forward = f4_gt(f4_add(f4_mul(p->vx, p->dirx), f4_mul(p->vy, p->diry)), zero);
+			f4 flip = f4_and(p->moves, f4_or(f4_and(forward, f4_gt(along, p->length)), f4_andnot(forward, f4_lt(along, zero))));
+			p->vx = f4_select(flip, f4_sub(zero, p->vx), p->vx);
+			p->vy = f4_select(flip, f4_sub(zero, p->vy), p->vy);
+			f4 c = p->cos_angle, s = p->sin_angle;
+			p->cos_angle = f4_sub(f4_mul(c, p->cos_step), f4_mul(s, p->sin_step));
+			p->sin_angle = f4_add(f4_mul(s, p->cos_step), f4_mul(c, p->sin_step));
+			c = p->cos_angle; s = p->sin_angle;
+
+			// closest point on the box to the ball, in the box's coordinates
+			f4 dx = f4_sub(nbx, p->x), dy = f4_sub(nby, p->y);
+			f4 lx = f4_add(f4_mul(c, dx), f4_mul(s, dy));
+			f4 ly = f4_sub(f4_mul(c, dy), f4_mul(s, dx));
+			f4 qx = f4_clamp(lx, f4_sub(zero, p->half_width), p->half_width);
+			f4 qy = f4_clamp(ly, f4_sub(zero, half_height), half_height);
+			f4 ex = f4_sub(lx, qx), ey = f4_sub(ly, qy);
+			f4 d2 = f4_add(f4_mul(ex, ex), f4_mul(ey, ey));
+			f4 hit = f4_and(alive, f4_and(f4_lt(d2, r2), f4_gt(d2, f4_set1(1e-12f))));
+			if (!f4_any(hit)) continue;
+			f4 d = f4_sqrt(f4_max(d2, f4_set1(1e-12f)));
+			f4 nlx = f4_div(ex, d), nly = f4_div(ey, d);
+			f4 nx = f4_sub(f4_mul(c, nlx), f4_mul(s, nly));
+			f4 ny = f4_add(f4_mul(s, nlx), f4_mul(c, nly));
+			// push the ball out
+			f4 penetration = f4_sub(r, d);
+			nbx = f4_select(hit, f4_add(nbx, f4_mul(nx, penetration)), nbx);
+			nby = f4_select(hit, f4_add(nby, f4_mul(ny, penetration)), nby);
+			// velocity of the platform where the ball is
+			f4 pvx = f4_sub(p->vx, f4_mul(p->angular_velocity, dy));
+			f4 pvy = f4_add(p->vy, f4_mul(p->angular_velocity, dx));
+			f4 rvx = f4_sub(nbvx, pvx), rvy = f4_sub(nbvy, pvy);
+			f4 vn = f4_add(f4_mul(rvx, nx), f4_mul(rvy, ny));
+			f4 approaching = f4_and(hit, f4_lt(vn, zero));
+			// normal impulse (per unit mass), with restitution if it's fast enough
+			f4 bounce = f4_select(f4_gt(f4_sub(zero, vn), bounce_speed), e, zero);
+			f4 jn = f4_mul(f4_sub(zero, vn), f4_add(one, bounce));
+			// friction: stop the contact point slipping (the ball is a disk, so its effective mass for this is 1/3),
+			// but with an impulse of at most mu * jn
+			f4 tx = f4_sub(zero, ny), ty = nx;
+			f4 slip = f4_sub(f4_add(f4_mul(rvx, tx), f4_mul(rvy, ty)), f4_mul(nbw, r));
+			f4 jt_max = f4_mul(mu, jn);
+			f4 jt = f4_clamp(f4_div(slip, f4_set1(3)), f4_sub(zero, jt_max), jt_max);
+			nbvx = f4_select(approaching, f4_sub(f4_add(nbvx, f4_mul(jn, nx)), f4_mul(jt, tx)), nbvx);
+			nbvy = f4_select(approaching, f4_sub(f4_add(nbvy, f4_mul(jn, ny)), f4_mul(jt, ty)), nbvy);
+			nbw = f4_select(approaching, f4_add(nbw, f4_div(f4_mul(f4_set1(2), jt), r)), nbw);
+		}
+
+		// left wall
+		f4 hit_wall = f4_lt(nbx, left);
+		nbx = f4_select(hit_wall, left, nbx);
+		nbvx = f4_select(f4_and(hit_wall, f4_lt(nbvx, zero)), f4_mul(f4_sub(zero, e), nbvx), nbvx);
+
+		// only update lanes which are still going
+		bx = f4_select(alive, nbx, bx);
+		by = f4_select(alive, nby, by);
+		bvx = f4_select(alive, nbvx, bvx);
+		bvy = f4_select(alive, nbvy, bvy);
+		bw = f4_select(alive, nbw, bw);
+		time = f4_select(alive, f4_add(time, h), time);
+		stuck_time = f4_select(alive, f4_add(stuck_time, h), stuck_time);
+		f4 record = f4_and(alive, f4_gt(bx, f4_add(furthest, f4_set1(0.005f))));
+		furthest = f4_select(record, bx, furthest);
+		stuck_time = f4_select(record, zero, stuck_time);
+
+		// is the ball done?
+		f4 reached_bottom = f4_lt(by, bottom);
+		f4 stuck = f4_gt(stuck_time, f4_set1(max_stuck_time));
+		f4 too_long = f4_gt(time, f4_set1(max_time));
+		// in free flight past every platform (see simulate_ballistic_exit): it lands at
+		// x + vx * t, where y + vy * t + g/2 t^2 = bottom
+		f4 free_flight = f4_and(f4_gt(f4_sub(bx, r), platforms_right), f4_gt(bvx, zero));
+		f4 height = f4_max(f4_sub(by, bottom), zero);
+		f4 g = f4_set1(-GRAVITY);
+		f4 t_land = f4_div(f4_add(bvy, f4_sqrt(f4_add(f4_mul(bvy, bvy), f4_mul(f4_mul(f4_set1(2), g), height)))), g);
+		f4 flight_x = f4_add(bx, f4_mul(bvx, t_land));
+		f4 done = f4_and(alive, f4_or(f4_or(reached_bottom, stuck), f4_or(too_long, free_flight)));
+		landed_x = f4_select(done, f4_select(free_flight, flight_x, bx), landed_x);
+		alive = f4_andnot(done, alive);
+	}
+
+	float x[4];
+	f4_store(x, landed_x);
+	for (u32 lane = 0; lane < nsetups; ++lane)
+		scores[lane] = x[lane] - starting_line[lane];
+}
+
+// approximate the scores of setups[indices[0..nsetups)] (or setups[0..nsetups) if indices is NULL)
+static void surrogate_score(SimContext const *sim, Setup const *setups, u32 const *indices, u32 nsetups, float *scores) {
+	for (u32 i = 0; i < nsetups; i += SURROGATE_LANES) {
+		u32 n = nsetups - i < SURROGATE_LANES ? nsetups - i : SURROGATE_LANES;
+		Setup const *batch[SURROGATE_LANES];
+		for (u32 lane = 0; lane < n; ++lane)
+			batch[lane] = &setups[indices ? indices[i + lane] : i + lane];
+		surrogate_score_batch(sim, batch, n, &scores[i]);
+	}
+}
+
+// score setups like setups_score_parallel, except the ones which the surrogate simulator thinks are
+// far worse than the worst of the top setups; those just get their approximate score.
+// if simulated isn't NULL, simulated[i] is set to whether the i'th setup was really simulated.
+static void setups_score_screened(State *state, Setup *setups, SetupRecord *records, u32 const *indices, u32 nsetups, bool *simulated) {
+	if (simulated) {
+		for (u32 i = 0; i < nsetups; ++i) simulated[i] = true;
+	}
+	if (!state->surrogate_screen || nsetups == 0) {
+		setups_score_parallel(state, setups, records, indices, nsetups);
+		return;
+	}
+	float *approx = calloc_arr(float, nsetups);
+	u32 *promising = calloc_arr(u32, nsetups);
+	// (the skipped setups are only simulated to see how good the surrogate is, so they're copied)
+	Setup *skipped = state->surrogate_report ? calloc_arr(Setup, nsetups) : NULL;
+	if (!approx || !promising || (state->surrogate_report && !skipped)) {
+		// out of memory; just score them all
+		free(approx); free(promising); free(skipped);
+		setups_score_parallel(state, setups, records, indices, nsetups);
+		return;
+	}
+
+	float top_score = setup_top(state, state->top_kept - 1)->score;
+	float threshold = top_score - state->surrogate_margin;
+	surrogate_score(&state->sim, setups, indices, nsetups, approx);
+	u32 npromising = 0, nskipped = 0;
+	for (u32 i = 0; i < nsetups; ++i) {
+		u32 s = indices ? indices[i] : i;
+		if (approx[i] >= threshold)
+			promising[npromising++] = s;
+		else if (skipped)
+			skipped[nskipped++] = setups[s];
+	}
+	setups_score_parallel(state, setups, records, promising, npromising);
+	if (skipped)
+		setups_score_parallel(state, skipped, NULL, NULL, nskipped);
+
+	SurrogateStats *stats = &state->surrogate_stats;
+	stats->nscreened += nsetups;
+	stats->nskipped += nsetups - npromising;
+	u32 k = 0;
+	for (u32 i = 0; i < nsetups; ++i) {
+		u32 s = indices ? indices[i] : i;
+		Setup *setup = &setups[s];
+		float real;
+		if (approx[i] >= threshold) {
+			real = setup->score;
+		} else {
+			real = skipped ? skipped[k++].score : 0;
+			setup->score = approx[i];
+			setup->total_time = 0;
+			if (records) records[s].valid = false;
+			if (simulated) simulated[i] = false;
+			if (state->surrogate_report && real >= top_score) ++stats->nwrongly_skipped;
+		}
+		if (state->surrogate_report) {
+			double a = approx[i], r = real;
+			stats->total_error += fabs(a - r);
+			stats->sum_a += a; stats->sum_r += r;
+			stats->sum_aa += a * a; stats->sum_rr += r * r; stats->sum_ar += a * r;
+		}
+	}
+
+	free(approx); free(promising); free(skipped);
+}
@@ -0,0 +1,100 @@
+// threads, with the same interface on Windows and everywhere else
+#if _WIN32
+typedef HANDLE Thread;
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_t Thread;
+#endif
+
+typedef void (*ThreadFn)(void *data);
+
+typedef struct {
+	ThreadFn fn;
+	void *data;
+} ThreadStart;
+
+#if _WIN32
+static DWORD WINAPI thread_start(LPVOID start_void) {
+#else
+static void *thread_start(void *start_void) {
+#endif
+	ThreadStart start = *(ThreadStart *)start_void;
+	free(start_void);
+	start.fn(start.data);
+	return 0;
+}
+
+// start a new thread which calls fn(data). returns false on failure.
+static bool thread_create(Thread *thread, ThreadFn fn, void *data) {
+	ThreadStart *start = (ThreadStart *)calloc(1, sizeof *start);
+	if (!start) return false;
+	start->fn = fn;
+	start->data = data;
+#if _WIN32
+	*thread = CreateThread(NULL, 0, thread_start, start, 0, NULL);
+	if (*thread) return true;
+#else
+	if (pthread_create(thread, NULL, thread_start, start) == 0) return true;
+#endif
+	free(start);
+	return false;
+}
+
+// wait for a thread to finish
+static void thread_join(Thread thread) {
+#if _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+// number of CPUs available (at least 1)
+static u32 thread_cpu_count(void) {
+#if _WIN32
+	SYSTEM_INFO info = {};
+	GetSystemInfo(&info);
+	u32 count = (u32)info.dwNumberOfProcessors;
+#else
+	long count_l = sysconf(_SC_NPROCESSORS_ONLN);
+	u32 count = count_l > 0 ? (u32)count_l : 1;
+#endif
+	return count ? count : 1;
+}
+
+// sequentially-consistent atomic operations
+static i32 atomic_load_i32(i32 volatile *p) {
+#if _MSC_VER
+	return (i32)InterlockedCompareExchange((LONG volatile *)p, 0, 0);
+#else
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void atomic_store_i32(i32 volatile *p, i32 x) {
+#if _MSC_VER
+	InterlockedExchange((LONG volatile *)p, (LONG)x);
+#else
+	__atomic_store_n(p, x, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// set *p to x, and return what it was before
+static i32 atomic_exchange_i32(i32 volatile *p, i32 x) {
+#if _MSC_VER
+	return (i32)InterlockedExchange((LONG volatile *)p, (LONG)x);
+#else
+	return __atomic_exchange_n(p, x, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// if *p == expected, set *p to desired and return true. otherwise, return false.
+static bool atomic_cas_i32(i32 volatile *p, i32 expected, i32 desired) {
+#if _MSC_VER
+	return InterlockedCompareExchange((LONG volatile *)p, (LONG)desired, (LONG)expected) == (LONG)expected;
+#else
+	return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
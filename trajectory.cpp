@@ -0,0 +1,282 @@
+/*
+Trajectories: everything that happens when a setup is simulated (where the ball and the moving/rotating
+platforms are after each time step), so that it can be played back without Box2D.
+Each frame is the ball's position, then the position and angle of each moving/rotating platform,
+quantized to TRAJECTORY_POSITION_UNIT meters/TRAJECTORY_ANGLE_UNIT radians. Each number is stored as the
+difference from the same number in the last frame (zigzag-encoded, so that small negative differences are small),
+in a variable number of bytes: 7 bits per byte, with the top bit set if there's another byte.
+Things don't move far in one time step, so that's mostly one byte per number.
+Every TRAJECTORY_KEYFRAME_EVERY'th frame is stored as the difference from 0 instead, so that playback can
+start from any frame after decoding at most TRAJECTORY_KEYFRAME_EVERY - 1 others.
+
+.b2t files are a header (magic, version, number of frames, size of the encoded frames), then the setup
+(like in population files), then the encoded frames.
+*/
+
+#define TRAJECTORY_POSITION_UNIT 0.001f
+#define TRAJECTORY_ANGLE_UNIT 0.0001f
+#define TRAJECTORY_MAX_FRAME_SIZE (5 * TRAJECTORY_NVALUES)
+#define TRAJECTORY_MAGIC 0x54533242 // "B2ST"
+#define TRAJECTORY_VERSION 1
+
+static i32 trajectory_quantize(float x, float unit) {
+	float q = roundf(x / unit);
+	if (!(q > -2e9f)) q = -2e9f; // (this also catches NaNs)
+	if (q > 2e9f) q = 2e9f;
+	return (i32)q;
+}
+
+static void trajectory_free(Trajectory *trajectory) {
+	free(trajectory->data);
+	free(trajectory->keyframes);
+	memset(trajectory, 0, sizeof *trajectory);
+}
+
+// throw away what's been recorded, and get ready to record the simulation of the setup in sim
+static void trajectory_start(Trajectory *trajectory, SimContext const *sim) {
+	trajectory->nplatforms = sim->nplatforms;
+	trajectory->moving = 0;
+	for (u32 i = 0; i < sim->nplatforms; ++i)
+		if (sim->platforms[i].moves || sim->platforms[i].rotates)
+			trajectory->moving |= (u32)1 << i;
+	trajectory->nframes = 0;
+	trajectory->size = 0;
+	trajectory->nkeyframes = 0;
+	trajectory->furthest_x = INT32_MIN;
+	trajectory->failed = false;
+}
+
+// the numbers in a frame of sim. returns how many there are.
+static u32 trajectory_values(Trajectory const *trajectory, SimContext const *sim, i32 *values) {
+	u32 n = 0;
+	values[n++] = trajectory_quantize(sim->ball.pos.x, TRAJECTORY_POSITION_UNIT);
+	values[n++] = trajectory_quantize(sim->ball.pos.y, TRAJECTORY_POSITION_UNIT);
+	for (u32 i = 0; i < trajectory->nplatforms; ++i) {
+		if (!(trajectory->moving & ((u32)1 << i))) continue;
+		Platform const *platform = &sim->platforms[i];
+		values[n++] = trajectory_quantize(platform->center.x, TRAJECTORY_POSITION_UNIT);
+		values[n++] = trajectory_quantize(platform->center.y, TRAJECTORY_POSITION_UNIT);
+		values[n++] = trajectory_quantize(platform->angle, TRAJECTORY_ANGLE_UNIT);
+	}
+	return n;
+}
+
+// add where everything in sim is now to sim->trajectory
+static void trajectory_add_frame(SimContext *sim) {
+	Trajectory *trajectory = sim->trajectory;
+	if (trajectory->failed) return;
+	if (trajectory->size + TRAJECTORY_MAX_FRAME_SIZE > trajectory->cap) {
+		u32 cap = trajectory->cap ? trajectory->cap * 2 : 4096;
+		u8 *data = (u8 *)realloc(trajectory->data, cap);
+		if (!data || cap < trajectory->cap) {
+			trajectory->failed = true;
+			return;
+		}
+		trajectory->data = data;
+		trajectory->cap = cap;
+	}
+	i32 values[TRAJECTORY_NVALUES];
+	u32 nvalues = trajectory_values(trajectory, sim, values);
+	if (values[0] > trajectory->furthest_x) trajectory->furthest_x = values[0];
+	if (trajectory->nframes % TRAJECTORY_KEYFRAME_EVERY == 0) {
+		if (trajectory->nkeyframes == trajectory->keyframes_cap) {
+			u32 cap = trajectory->keyframes_cap ? trajectory->keyframes_cap * 2 : 64;
+			TrajectoryKeyframe *keyframes = (TrajectoryKeyframe *)realloc(trajectory->keyframes, cap * sizeof *keyframes);
+			if (!keyframes) {
+				trajectory->failed = true;
+				return;
+			}
+			trajectory->keyframes = keyframes;
+			trajectory->keyframes_cap = cap;
+		}
+		TrajectoryKeyframe *keyframe = &trajectory->keyframes[trajectory->nkeyframes++];
+		keyframe->offset = trajectory->size;
+		keyframe->furthest_x = trajectory->furthest_x;
+		memset(trajectory->last, 0, sizeof trajectory->last);
+	}
+	u8 *p = trajectory->data + trajectory->size;
+	for (u32 v = 0; v < nvalues; ++v) {
+		u32 delta = (u32)values[v] - (u32)trajectory->last[v];
+		u32 zigzag = (delta << 1) ^ ((delta & 0x80000000) ? 0xffffffff : 0);
+		while (zigzag >= 0x80) {
+			*p++ = (u8)(zigzag | 0x80);
+			zigzag >>= 7;
+		}
+		*p++ = (u8)zigzag;
+		trajectory->last[v] = values[v];
+	}
+	trajectory->size = (u32)(p - trajectory->data);
+	++trajectory->nframes;
+}
+
+// decode the frame at *offset, which comes after last (or is a keyframe), into values, and move *offset past it.
+// returns false if the data is invalid.
+static bool trajectory_decode(Trajectory const *trajectory, u32 *offset, i32 const *last, i32 *values, u32 nvalues) {
+	u32 o = *offset;
+	for (u32 v = 0; v < nvalues; ++v) {
+		u32 zigzag = 0;
+		for (u32 shift = 0; ; shift += 7) {
+			if (o >= trajectory->size || shift > 28) return false;
+			u8 byte = trajectory->data[o++];
+			zigzag |= (u32)(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) break;
+		}
+		u32 delta = (zigzag >> 1) ^ ((zigzag & 1) ? 0xffffffff : 0);
+		values[v] = (i32)((u32)last[v] + delta);
+	}
+	*offset = o;
+	return true;
+}
+
+static u32 trajectory_nvalues(Trajectory const *trajectory) {
+	u32 nmoving = 0;
+	for (u32 i = 0; i < trajectory->nplatforms; ++i)
+		nmoving += (trajectory->moving >> i) & 1;
+	return 2 + 3 * nmoving;
+}
+
+// put everything in sim where it was in the given frame (sim should have the setup which was recorded).
+// this also sets the time and the furthest the ball went, like simulating up to there would.
+// returns false if the trajectory is invalid.
+static bool trajectory_apply(Trajectory const *trajectory, u32 frame, SimContext *sim) {
+	if (frame >= trajectory->nframes || sim->nplatforms != trajectory->nplatforms) return false;
+	u32 nvalues = trajectory_nvalues(trajectory);
+	u32 k = frame / TRAJECTORY_KEYFRAME_EVERY;
+	if (k >= trajectory->nkeyframes) return false;
+	u32 offset = trajectory->keyframes[k].offset;
+	i32 furthest_x = trajectory->keyframes[k].furthest_x;
+	i32 values[TRAJECTORY_NVALUES] = {0}, last[TRAJECTORY_NVALUES] = {0};
+	for (u32 f = k * TRAJECTORY_KEYFRAME_EVERY; f <= frame; ++f) {
+		if (!trajectory_decode(trajectory, &offset, last, values, nvalues)) return false;
+		if (values[0] > furthest_x) furthest_x = values[0];
+		memcpy(last, values, nvalues * sizeof *values);
+	}
+	Ball *ball = &sim->ball;
+	ball->pos = V2((float)values[0] * TRAJECTORY_POSITION_UNIT, (float)values[1] * TRAJECTORY_POSITION_UNIT);
+	u32 v = 2;
+	for (u32 i = 0; i < trajectory->nplatforms; ++i) {
+		if (!(trajectory->moving & ((u32)1 << i))) continue;
+		Platform *platform = &sim->platforms[i];
+		platform->center = V2((float)values[v] * TRAJECTORY_POSITION_UNIT, (float)values[v+1] * TRAJECTORY_POSITION_UNIT);
+		platform->angle = (float)values[v+2] * TRAJECTORY_ANGLE_UNIT;
+		v += 3;
+	}
+	sim->furthest_ball_x_pos = (float)furthest_x * TRAJECTORY_POSITION_UNIT;
+	sim->total_time = (float)frame * TIME_STEP;
+	return true;
+}
+
+// how long the recorded simulation lasted, in seconds
+static float trajectory_duration(Trajectory const *trajectory) {
+	return trajectory->nframes ? (float)(trajectory->nframes - 1) * TIME_STEP : 0;
+}
+
+// simulate setup (on this thread, in sim), recording everything that happens into trajectory.
+// setup's score is set like setup_score does. returns false if there isn't enough memory.
+static bool trajectory_record(SimContext *sim, Setup *setup, Trajectory *trajectory) {
+	bool ballistic_exit = sim->ballistic_exit, prune = sim->prune;
+	sim->ballistic_exit = sim->prune = false;
+	sim->trajectory = trajectory;
+	setup_score(sim, setup, NULL);
+	sim->trajectory = NULL;
+	sim->ballistic_exit = ballistic_exit;
+	sim->prune = prune;
+	return !trajectory->failed;
+}
+
+// work out the keyframes of a trajectory which has just been read. returns false if it's invalid.
+static bool trajectory_index(Trajectory *trajectory) {
+	u32 nvalues = trajectory_nvalues(trajectory);
+	u32 nkeyframes = (trajectory->nframes + TRAJECTORY_KEYFRAME_EVERY - 1) / TRAJECTORY_KEYFRAME_EVERY;
+	trajectory->keyframes = calloc_arr(TrajectoryKeyframe, nkeyframes ? nkeyframes : 1);
+	if (!trajectory->keyframes) return false;
+	trajectory->keyframes_cap = nkeyframes;
+	trajectory->nkeyframes = 0;
+	trajectory->furthest_x = INT32_MIN;
+	u32 offset = 0;
+	i32 values[TRAJECTORY_NVALUES] = {0}, last[TRAJECTORY_NVALUES] = {0};
+	for (u32 f = 0; f < trajectory->nframes; ++f) {
+		if (f % TRAJECTORY_KEYFRAME_EVERY == 0) {
+			memset(last, 0, sizeof last);
+			TrajectoryKeyframe *keyframe = &trajectory->keyframes[trajectory->nkeyframes++];
+			keyframe->offset = offset;
+			keyframe->furthest_x = trajectory->furthest_x;
+		}
+		if (!trajectory_decode(trajectory, &offset, last, values, nvalues)) return false;
+		if (values[0] > trajectory->furthest_x) {
+			trajectory->furthest_x = values[0];
+			// (the keyframe's furthest_x includes the keyframe itself)
+			if (f % TRAJECTORY_KEYFRAME_EVERY == 0)
+				trajectory->keyframes[trajectory->nkeyframes - 1].furthest_x = values[0];
+		}
+		memcpy(last, values, nvalues * sizeof *values);
+	}
+	return offset == trajectory->size;
+}
+
+// write trajectory, which was recorded for setup, to a .b2t file
+static bool trajectory_write_to_file(Trajectory const *trajectory, Setup const *setup, char const *filename) {
+	size_t size = 4 + 4 + 4 + 4 + population_setup_size(setup) + trajectory->size;
+	u8 *data = (u8 *)malloc(size);
+	if (!data) return false;
+	u32 header[4] = {TRAJECTORY_MAGIC, TRAJECTORY_VERSION, trajectory->nframes, trajectory->size};
+	u8 *p = population_put(data, header, sizeof header);
+	p = population_put_setup(p, setup);
+	p = population_put(p, trajectory->data, trajectory->size);
+	assert(p == data + size);
+	bool success = file_write_all(filename, data, size);
+	free(data);
+	return success;
+}
+
+// read a .b2t file. returns false if it couldn't be read, isn't a .b2t file, or is invalid.
+static bool trajectory_load(Trajectory *trajectory, Setup *setup, char const *filename) {
+	memset(trajectory, 0, sizeof *trajectory);
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) return false;
+	u32 header[4] = {0};
+	if (fread(header, sizeof header, 1, fp) != 1 || header[0] != TRAJECTORY_MAGIC) {
+		fclose(fp);
+		return false;
+	}
+	bool ok = header[1] == TRAJECTORY_VERSION;
+	size_t size = 0;
+	u8 *data = NULL;
+	if (ok) {
+		fseek(fp, 0, SEEK_END);
+		long file_size = ftell(fp);
+		ok = file_size > (long)sizeof header;
+		if (ok) {
+			size = (size_t)file_size - sizeof header;
+			data = (u8 *)malloc(size);
+			fseek(fp, sizeof header, SEEK_SET);
+			ok = data && fread(data, 1, size, fp) == size;
+		}
+	}
+	fclose(fp);
+	u8 const *p = data, *end = data + size;
+	ok = ok && population_get_setup(&p, end, setup) && (size_t)(end - p) == header[3];
+	if (ok) {
+		trajectory->nplatforms = setup->nplatforms;
+		for (u32 i = 0; i < setup->nplatforms; ++i)
+			if (setup->platforms[i].moves || setup->platforms[i].rotates)
+				trajectory->moving |= (u32)1 << i;
+		trajectory->nframes = header[2];
+		trajectory->size = trajectory->cap = header[3];
+		// every number takes at least one byte, so don't believe nframes if there aren't enough bytes for it
+		// (trajectory_index allocates keyframes based on it)
+		ok = trajectory->nframes <= trajectory->size / trajectory_nvalues(trajectory);
+	}
+	if (ok) {
+		trajectory->data = (u8 *)malloc(trajectory->size ? trajectory->size : 1);
+		ok = trajectory->data != NULL;
+		if (ok) memcpy(trajectory->data, p, trajectory->size);
+	}
+	free(data);
+	ok = ok && trajectory_index(trajectory);
+	if (!ok) {
+		logln("Invalid trajectory file: %s.", filename);
+		trajectory_free(trajectory);
+	}
+	return ok;
+}
@@ -1,5 +1,6 @@
 #if _WIN32
 #include <direct.h>
+#include <io.h>
 #endif
 #ifndef arr_count
 #define arr_count(a) (sizeof (a) / sizeof *(a))
@@ -184,6 +185,10 @@ static void fwrite_u32(FILE *fp, u32 x) {
 	fwrite(&x, sizeof x, 1, fp);
 }
 
+static void fwrite_u64(FILE *fp, u64 x) {
+	fwrite(&x, sizeof x, 1, fp);
+}
+
 static void fwrite_float(FILE *fp, float x) {
 	fwrite(&x, sizeof x, 1, fp);
 }
@@ -204,6 +209,12 @@ static u32 fread_u32(FILE *fp) {
 	return x;
 }
 
+static u64 fread_u64(FILE *fp) {
+	u64 x;
+	fread(&x, sizeof x, 1, fp);
+	return x;
+}
+
 static float fread_float(FILE *fp) {
 	float x;
 	fread(&x, sizeof x, 1, fp);
@@ -216,13 +227,145 @@ static v2 fread_v2(FILE *fp) {
 	return v;
 }
 
+// like fread, but from memory: copies size bytes from *p to x and moves *p past them,
+// or returns false if there aren't size bytes before end
+static bool mem_read(u8 const **p, u8 const *end, void *x, size_t size) {
+	if ((size_t)(end - *p) < size) return false;
+	memcpy(x, *p, size);
+	*p += size;
+	return true;
+}
+
 #if _WIN32
 static void make_directory(char const *name) {
 	_mkdir(name);
 }
+
+static bool file_exists(char const *name) {
+	return _access(name, 0) == 0;
+}
+
+// make sure everything written to fp is on the disk (not just in the OS's cache)
+static bool file_sync(FILE *fp) {
+	return fflush(fp) == 0 && _commit(_fileno(fp)) == 0;
+}
+
+// replace the file to with from, so that anything reading to sees either the old file or the new one
+static bool file_replace(char const *from, char const *to) {
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+// size of the file fp is open in (which might be too big for ftell). returns false on failure.
+static bool file_size(FILE *fp, u64 *size) {
+	if (fflush(fp) != 0) return false;
+	__int64 length = _filelengthi64(_fileno(fp));
+	if (length < 0) return false;
+	*size = (u64)length;
+	return true;
+}
+
+// cut the file fp is open in down to size bytes (fp's buffer should be flushed first)
+static bool file_truncate(FILE *fp, u64 size) {
+	return fflush(fp) == 0 && _chsize_s(_fileno(fp), (__int64)size) == 0;
+}
+
+// a file mapped into memory, read-only
+typedef struct {
+	u8 const *data; // NULL if the file is empty
+	size_t size;
+	HANDLE mapping;
+} MappedFile;
+
+// returns false if the file couldn't be opened or mapped
+static bool file_map(MappedFile *map, char const *filename) {
+	memset(map, 0, sizeof *map);
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size = {};
+	bool success = GetFileSizeEx(file, &size) != 0 && (u64)size.QuadPart <= SIZE_MAX;
+	if (success && size.QuadPart > 0) {
+		map->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		map->data = map->mapping ? (u8 const *)MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		success = map->data != NULL;
+		map->size = (size_t)size.QuadPart;
+	}
+	CloseHandle(file); // (the mapping keeps it open)
+	if (!success) {
+		if (map->mapping) CloseHandle(map->mapping);
+		memset(map, 0, sizeof *map);
+	}
+	return success;
+}
+
+static void file_unmap(MappedFile *map) {
+	if (map->data) UnmapViewOfFile(map->data);
+	if (map->mapping) CloseHandle(map->mapping);
+	memset(map, 0, sizeof *map);
+}
 #else
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 static void make_directory(char const *name) {
 	mkdir(name, 0755);
 }
+
+static bool file_exists(char const *name) {
+	return access(name, F_OK) == 0;
+}
+
+// make sure everything written to fp is on the disk (not just in the OS's cache)
+static bool file_sync(FILE *fp) {
+	return fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+}
+
+// replace the file to with from, so that anything reading to sees either the old file or the new one
+static bool file_replace(char const *from, char const *to) {
+	return rename(from, to) == 0;
+}
+
+// size of the file fp is open in (which might be too big for ftell). returns false on failure.
+static bool file_size(FILE *fp, u64 *size) {
+	struct stat st = {};
+	if (fflush(fp) != 0 || fstat(fileno(fp), &st) != 0) return false;
+	*size = (u64)st.st_size;
+	return true;
+}
+
+// cut the file fp is open in down to size bytes
+static bool file_truncate(FILE *fp, u64 size) {
+	return fflush(fp) == 0 && ftruncate(fileno(fp), (off_t)size) == 0;
+}
+
+// a file mapped into memory, read-only
+typedef struct {
+	u8 const *data; // NULL if the file is empty
+	size_t size;
+} MappedFile;
+
+// returns false if the file couldn't be opened or mapped
+static bool file_map(MappedFile *map, char const *filename) {
+	memset(map, 0, sizeof *map);
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st = {};
+	bool success = fstat(fd, &st) == 0 && (u64)st.st_size <= SIZE_MAX;
+	if (success && st.st_size > 0) {
+		void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		success = data != MAP_FAILED;
+		if (success) {
+			map->data = (u8 const *)data;
+			map->size = (size_t)st.st_size;
+		}
+	}
+	close(fd); // (the mapping keeps it open)
+	return success;
+}
+
+static void file_unmap(MappedFile *map) {
+	if (map->data) munmap((void *)map->data, map->size);
+	memset(map, 0, sizeof *map);
+}
 #endif
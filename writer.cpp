@@ -0,0 +1,102 @@
+/*
+The writer thread writes the files saved after each generation, so that scoring the next generation
+doesn't have to wait for the disk.
+Files are put together in memory by the thread scoring setups, and handed to the writer through a queue of
+WRITER_QUEUE_SIZE jobs. There's one thread adding jobs and one taking them, so the queue is just two
+indices. If the disk is so slow that the queue fills up, writer_submit waits for the writer to catch up,
+so we never use more than WRITER_QUEUE_SIZE files' worth of memory; time spent waiting goes in Writer.wait_time.
+*/
+
+// write data to filename, by writing it to a temporary file and then replacing filename with it,
+// so that filename is never half-written
+static bool file_write_all(char const *filename, u8 const *data, size_t size) {
+	char tmp_filename[520] = {0};
+	snprintf(tmp_filename, sizeof tmp_filename - 1, "%s.tmp", filename);
+	FILE *fp = fopen(tmp_filename, "wb");
+	bool success = fp != NULL;
+	if (fp) {
+		success = fwrite(data, 1, size, fp) == size;
+		success &= fclose(fp) == 0;
+	}
+	if (success) success = file_replace(tmp_filename, filename);
+	if (!success) {
+		logln("Couldn't write %s.", filename);
+		remove(tmp_filename);
+	}
+	return success;
+}
+
+static bool history_append(History *history, u8 const *record, size_t size);
+
+static bool write_job_do(WriteJob const *job) {
+	if (job->history)
+		return history_append(job->history, job->data, job->size);
+	else
+		return file_write_all(job->filename, job->data, job->size);
+}
+
+static void writer_run(void *writer_void) {
+	Writer *writer = (Writer *)writer_void;
+	while (true) {
+		i32 head = atomic_load_i32(&writer->head);
+		if (head == atomic_load_i32(&writer->tail)) {
+			// nothing to write. (jobs added before quit was set have been written by now)
+			if (atomic_load_i32(&writer->quit)) break;
+			time_sleep_ms(5);
+			continue;
+		}
+		WriteJob *job = &writer->jobs[head % WRITER_QUEUE_SIZE];
+		if (!write_job_do(job))
+			atomic_store_i32(&writer->nfailed, atomic_load_i32(&writer->nfailed) + 1);
+		free(job->data);
+		job->data = NULL;
+		atomic_store_i32(&writer->head, head + 1);
+	}
+}
+
+// start the writer thread. if it can't be started, files are just written by writer_submit.
+static void writer_start(Writer *writer) {
+	if (writer->running) return;
+	writer->head = writer->tail = 0;
+	writer->quit = 0;
+	writer->running = thread_create(&writer->thread, writer_run, writer);
+	if (!writer->running) {
+		logln("Couldn't create writer thread. Files will be written while scoring.");
+	}
+}
+
+// write data (which must have been allocated with malloc, and is freed by this) to filename in the background,
+// or if history isn't NULL, append it to history (see history.cpp).
+// if the queue is full, this waits for there to be room.
+static void writer_submit(Writer *writer, char const *filename, History *history, u8 *data, size_t size) {
+	WriteJob job = {};
+	if (filename) str_cpy(job.filename, sizeof job.filename, filename);
+	job.history = history;
+	job.data = data;
+	job.size = size;
+	++writer->nwritten;
+	if (!writer->running) {
+		struct timespec start = time_get();
+		if (!write_job_do(&job)) ++writer->nfailed;
+		free(data);
+		writer->wait_time += timespec_sub(time_get(), start);
+		return;
+	}
+	i32 tail = writer->tail;
+	if (tail - atomic_load_i32(&writer->head) >= WRITER_QUEUE_SIZE) {
+		struct timespec start = time_get();
+		while (tail - atomic_load_i32(&writer->head) >= WRITER_QUEUE_SIZE)
+			time_sleep_ms(1);
+		writer->wait_time += timespec_sub(time_get(), start);
+	}
+	writer->jobs[tail % WRITER_QUEUE_SIZE] = job;
+	atomic_store_i32(&writer->tail, tail + 1);
+}
+
+// write everything that's left, then stop the writer thread
+static void writer_stop(Writer *writer) {
+	if (!writer->running) return;
+	atomic_store_i32(&writer->quit, 1);
+	thread_join(writer->thread);
+	writer->running = false;
+}